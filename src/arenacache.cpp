@@ -0,0 +1,361 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "arenacache.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <process.h>
+#include <share.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif //_WIN32
+
+// Bump this whenever the embedding changes what ends up inside of the arena.
+#define ARENA_CACHE_MAGIC       "D2XARENA"
+#define ARENA_CACHE_VERSION     2
+
+// FNV-1a.
+std::uint64_t ModuleArenaCache::HashData( const void *data, size_t dataSize, std::uint64_t hash )
+{
+    const unsigned char *bytes = (const unsigned char*)data;
+
+    for ( size_t n = 0; n < dataSize; n++ )
+    {
+        hash ^= bytes[ n ];
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+std::string ModuleArenaCache::GetEntryPath( const key& arenaKey ) const
+{
+    std::uint64_t keyHash = HashData( &arenaKey.moduleHash, sizeof(arenaKey.moduleHash) );
+    keyHash = HashData( &arenaKey.exeImageBase, sizeof(arenaKey.exeImageBase), keyHash );
+    keyHash = HashData( &arenaKey.arenaRVA, sizeof(arenaKey.arenaRVA), keyHash );
+    keyHash = HashData( &arenaKey.optionFlags, sizeof(arenaKey.optionFlags), keyHash );
+
+    char nameBuf[ 32 ];
+    snprintf( nameBuf, sizeof(nameBuf), "%016llx.arena", (unsigned long long)keyHash );
+
+    std::string path = this->cacheDir;
+
+    if ( !path.empty() && path.back() != '/' && path.back() != '\\' )
+    {
+        path += '/';
+    }
+
+    path += nameBuf;
+
+    return path;
+}
+
+// The payload (sections and relocations) is serialized in memory so that it can be
+// checksummed; the header in front of it carries its size and hash.
+struct payloadReader
+{
+    const char *data;
+    size_t dataSize;
+    size_t readPos = 0;
+
+    inline bool Read( void *bufOut, size_t readSize )
+    {
+        if ( readSize > ( this->dataSize - this->readPos ) )
+        {
+            return false;
+        }
+
+        memcpy( bufOut, this->data + this->readPos, readSize );
+
+        this->readPos += readSize;
+
+        return true;
+    }
+
+    template <typename numberType>
+    inline bool ReadNumber( numberType& valueOut )
+    {
+        return Read( &valueOut, sizeof(valueOut) );
+    }
+};
+
+template <typename numberType>
+static inline void AppendNumber( std::string& buf, numberType value )
+{
+    buf.append( (const char*)&value, sizeof(value) );
+}
+
+template <typename numberType>
+static inline bool ReadNumber( std::istream& stream, numberType& valueOut )
+{
+    stream.read( (char*)&valueOut, sizeof(valueOut) );
+
+    return stream.good();
+}
+
+// Creates a file that no other writer can have open, for the temporary copy of an entry.
+static int CreateUniqueFile( const std::string& basePath, std::string& pathOut )
+{
+#ifdef _WIN32
+    unsigned long long processId = (unsigned long long)_getpid();
+#else
+    unsigned long long processId = (unsigned long long)getpid();
+#endif //_WIN32
+
+    std::random_device randomSource;
+
+    for ( unsigned int tryIdx = 0; tryIdx < 16; tryIdx++ )
+    {
+        char suffixBuf[ 64 ];
+        snprintf( suffixBuf, sizeof(suffixBuf), ".%llu.%08x.tmp", processId, (unsigned int)randomSource() );
+
+        std::string tmpPath = ( basePath + suffixBuf );
+
+#ifdef _WIN32
+        int fd = -1;
+
+        _sopen_s( &fd, tmpPath.c_str(), _O_WRONLY | _O_CREAT | _O_EXCL | _O_BINARY, _SH_DENYNO, _S_IREAD | _S_IWRITE );
+#else
+        int fd = open( tmpPath.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644 );
+#endif //_WIN32
+
+        if ( fd != -1 )
+        {
+            pathOut = std::move( tmpPath );
+            return fd;
+        }
+
+        if ( errno != EEXIST )
+        {
+            break;
+        }
+    }
+
+    return -1;
+}
+
+static bool WriteFileData( int fd, const char *data, size_t dataSize )
+{
+    while ( dataSize > 0 )
+    {
+#ifdef _WIN32
+        int written = _write( fd, data, (unsigned int)std::min( dataSize, (size_t)0x40000000 ) );
+#else
+        ssize_t written = write( fd, data, dataSize );
+#endif //_WIN32
+
+        if ( written <= 0 )
+        {
+            return false;
+        }
+
+        data += written;
+        dataSize -= (size_t)written;
+    }
+
+    return true;
+}
+
+static bool CloseFile( int fd )
+{
+#ifdef _WIN32
+    return ( _close( fd ) == 0 );
+#else
+    return ( close( fd ) == 0 );
+#endif //_WIN32
+}
+
+bool ModuleArenaCache::Load( const key& arenaKey, arena& arenaOut ) const
+{
+    std::ifstream cacheStream( this->GetEntryPath( arenaKey ), std::ios::binary | std::ios::in );
+
+    if ( !cacheStream.good() )
+    {
+        return false;
+    }
+
+    char magic[ sizeof(ARENA_CACHE_MAGIC) - 1 ];
+    cacheStream.read( magic, sizeof(magic) );
+
+    if ( !cacheStream.good() || memcmp( magic, ARENA_CACHE_MAGIC, sizeof(magic) ) != 0 )
+    {
+        return false;
+    }
+
+    std::uint32_t version;
+    key storedKey;
+    std::uint64_t payloadSize;
+    std::uint64_t payloadHash;
+
+    if ( !ReadNumber( cacheStream, version ) ||
+         !ReadNumber( cacheStream, storedKey.moduleHash ) ||
+         !ReadNumber( cacheStream, storedKey.exeImageBase ) ||
+         !ReadNumber( cacheStream, storedKey.arenaRVA ) ||
+         !ReadNumber( cacheStream, storedKey.optionFlags ) ||
+         !ReadNumber( cacheStream, payloadSize ) ||
+         !ReadNumber( cacheStream, payloadHash ) )
+    {
+        return false;
+    }
+
+    // The file name is just a hash, so verify the entire key.
+    if ( version != ARENA_CACHE_VERSION ||
+         storedKey.moduleHash != arenaKey.moduleHash ||
+         storedKey.exeImageBase != arenaKey.exeImageBase ||
+         storedKey.arenaRVA != arenaKey.arenaRVA ||
+         storedKey.optionFlags != arenaKey.optionFlags )
+    {
+        return false;
+    }
+
+    // Entries are never bigger than what fits into the 32bit section sizes.
+    if ( payloadSize > 0xFFFFFFFFull )
+    {
+        return false;
+    }
+
+    std::vector <char> payload( (size_t)payloadSize );
+
+    cacheStream.read( payload.data(), payload.size() );
+
+    // A damaged entry is treated like a missing one and is stored again.
+    if ( (std::uint64_t)cacheStream.gcount() != payloadSize || HashData( payload.data(), payload.size() ) != payloadHash )
+    {
+        return false;
+    }
+
+    payloadReader reader;
+    reader.data = payload.data();
+    reader.dataSize = payload.size();
+
+    arena loadedArena;
+
+    std::uint32_t numSections;
+
+    if ( !reader.ReadNumber( numSections ) )
+    {
+        return false;
+    }
+
+    loadedArena.sectionData.resize( numSections );
+
+    for ( std::vector <char>& sectData : loadedArena.sectionData )
+    {
+        std::uint32_t sectDataSize;
+
+        if ( !reader.ReadNumber( sectDataSize ) )
+        {
+            return false;
+        }
+
+        sectData.resize( sectDataSize );
+
+        if ( !reader.Read( sectData.data(), sectDataSize ) )
+        {
+            return false;
+        }
+    }
+
+    std::uint32_t numRelocations;
+
+    if ( !reader.ReadNumber( numRelocations ) )
+    {
+        return false;
+    }
+
+    loadedArena.relocations.resize( numRelocations );
+
+    for ( relocation& reloc : loadedArena.relocations )
+    {
+        if ( !reader.ReadNumber( reloc.rva ) || !reader.ReadNumber( reloc.type ) )
+        {
+            return false;
+        }
+    }
+
+    arenaOut = std::move( loadedArena );
+
+    return true;
+}
+
+bool ModuleArenaCache::Store( const key& arenaKey, const arena& arenaData ) const
+{
+    std::string entryPath = this->GetEntryPath( arenaKey );
+
+    std::string payload;
+
+    AppendNumber( payload, (std::uint32_t)arenaData.sectionData.size() );
+
+    for ( const std::vector <char>& sectData : arenaData.sectionData )
+    {
+        AppendNumber( payload, (std::uint32_t)sectData.size() );
+
+        payload.append( sectData.data(), sectData.size() );
+    }
+
+    AppendNumber( payload, (std::uint32_t)arenaData.relocations.size() );
+
+    for ( const relocation& reloc : arenaData.relocations )
+    {
+        AppendNumber( payload, reloc.rva );
+        AppendNumber( payload, reloc.type );
+    }
+
+    std::string header( ARENA_CACHE_MAGIC, sizeof(ARENA_CACHE_MAGIC) - 1 );
+
+    AppendNumber( header, (std::uint32_t)ARENA_CACHE_VERSION );
+    AppendNumber( header, arenaKey.moduleHash );
+    AppendNumber( header, arenaKey.exeImageBase );
+    AppendNumber( header, arenaKey.arenaRVA );
+    AppendNumber( header, arenaKey.optionFlags );
+    AppendNumber( header, (std::uint64_t)payload.size() );
+    AppendNumber( header, HashData( payload.data(), payload.size() ) );
+
+    // Every writer fills its own temporary file and renames it into place, so concurrent
+    // runs that store the same key never write into the same file.
+    std::string tmpPath;
+
+    int fd = CreateUniqueFile( entryPath, tmpPath );
+
+    if ( fd == -1 )
+    {
+        return false;
+    }
+
+    bool couldWrite = WriteFileData( fd, header.data(), header.size() );
+
+    if ( couldWrite )
+    {
+        couldWrite = WriteFileData( fd, payload.data(), payload.size() );
+    }
+
+    if ( !CloseFile( fd ) )
+    {
+        couldWrite = false;
+    }
+
+    if ( !couldWrite )
+    {
+        remove( tmpPath.c_str() );
+        return false;
+    }
+
+    if ( rename( tmpPath.c_str(), entryPath.c_str() ) != 0 )
+    {
+        // Another run might have stored the same entry in the meantime.
+        remove( tmpPath.c_str() );
+        return false;
+    }
+
+    return true;
+}
\ No newline at end of file
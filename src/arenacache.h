@@ -0,0 +1,62 @@
+#ifndef _MODULE_ARENA_CACHE_
+#define _MODULE_ARENA_CACHE_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// On-disk cache of relocated module arenas.
+// Batch runs often embed the same module at the same place of the same executable, so the
+// rebased and patched section data is stored once and copied straight in on later runs.
+struct ModuleArenaCache
+{
+    // Everything the arena contents depend on.
+    struct key
+    {
+        std::uint64_t moduleHash;       // of the module file contents
+        std::uint64_t exeImageBase;
+        std::uint32_t arenaRVA;         // where the module image is placed inside the executable
+        std::uint32_t optionFlags;      // see eOptionFlags
+    };
+
+    enum eOptionFlags : std::uint32_t
+    {
+        OPTION_RELOCATABLE = 0x01,
+        OPTION_MARK_EXECUTABLE = 0x02,
+        OPTION_ARCH_X64 = 0x04
+    };
+
+    struct relocation
+    {
+        std::uint32_t rva;
+        std::uint32_t type;
+    };
+
+    struct arena
+    {
+        // Data of each module section, in module section order.
+        std::vector <std::vector <char>> sectionData;
+
+        // Base relocations that were registered in the executable for the arena.
+        std::vector <relocation> relocations;
+    };
+
+    inline ModuleArenaCache( std::string cacheDir ) : cacheDir( std::move( cacheDir ) )
+    {
+        return;
+    }
+
+    // Returns false if there is no valid entry for the key.
+    bool Load( const key& arenaKey, arena& arenaOut ) const;
+    bool Store( const key& arenaKey, const arena& arenaData ) const;
+
+    static std::uint64_t HashData( const void *data, size_t dataSize, std::uint64_t hash = 0xcbf29ce484222325ull );
+
+private:
+    std::string GetEntryPath( const key& arenaKey ) const;
+
+    std::string cacheDir;
+};
+
+#endif //_MODULE_ARENA_CACHE_
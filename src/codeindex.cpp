@@ -0,0 +1,504 @@
+#include "codeindex.h"
+
+#include <algorithm>
+
+// Operand encoding flags of opcodes.
+enum : unsigned char
+{
+    OP_NONE = 0,
+    OP_MODRM = 0x01,    // has a ModRM byte
+    OP_IMM8 = 0x02,     // 8bit immediate
+    OP_IMM16 = 0x04,    // 16bit immediate
+    OP_IMMZ = 0x08,     // 16 or 32bit immediate, depending on operand size
+    OP_SPECIAL = 0x10,  // handled in code
+    OP_INVALID = 0x20
+};
+
+static unsigned char GetOneByteOpcodeFlags( unsigned char op, bool is64Bit )
+{
+    // The arithmetic block (add, or, adc, sbb, and, sub, xor, cmp).
+    if ( op < 0x40 )
+    {
+        unsigned char low = ( op & 7 );
+
+        if ( low < 4 )          return OP_MODRM;
+        if ( low == 4 )         return OP_IMM8;
+        if ( low == 5 )         return OP_IMMZ;
+
+        // Push/pop segment and decimal adjust, which do not exist in 64bit mode.
+        // The 0x0F escape and the segment prefixes are handled by the caller.
+        return ( is64Bit ? OP_INVALID : OP_NONE );
+    }
+
+    if ( op < 0x60 )        return OP_NONE;     // inc/dec (REX is handled by the caller), push/pop
+
+    if ( op >= 0x70 && op <= 0x7F )     return OP_IMM8;     // jcc rel8
+    if ( op >= 0x91 && op <= 0x99 )     return OP_NONE;     // xchg, cbw, cwd
+    if ( op >= 0xB0 && op <= 0xB7 )     return OP_IMM8;     // mov r8, imm8
+    if ( op >= 0xB8 && op <= 0xBF )     return OP_SPECIAL;  // mov r, imm
+    if ( op >= 0xD8 && op <= 0xDF )     return OP_MODRM;    // x87
+    if ( op >= 0xE0 && op <= 0xE7 )     return OP_IMM8;     // loop, jcxz, in, out
+
+    switch( op )
+    {
+    case 0x60: case 0x61:
+        return ( is64Bit ? OP_INVALID : OP_NONE );
+    case 0x62:  // bound (EVEX is handled by the caller)
+        return ( is64Bit ? OP_INVALID : OP_MODRM );
+    case 0x63:
+        return OP_MODRM;
+    case 0x68:  return OP_IMMZ;
+    case 0x69:  return ( OP_MODRM | OP_IMMZ );
+    case 0x6A:  return OP_IMM8;
+    case 0x6B:  return ( OP_MODRM | OP_IMM8 );
+    case 0x6C: case 0x6D: case 0x6E: case 0x6F:
+        return OP_NONE;
+    case 0x80:  return ( OP_MODRM | OP_IMM8 );
+    case 0x81:  return ( OP_MODRM | OP_IMMZ );
+    case 0x82:  return ( is64Bit ? OP_INVALID : ( OP_MODRM | OP_IMM8 ) );
+    case 0x83:  return ( OP_MODRM | OP_IMM8 );
+    case 0x90:  return OP_NONE;
+    case 0x9A:  return ( is64Bit ? OP_INVALID : OP_SPECIAL );   // call far
+    case 0x9B: case 0x9C: case 0x9D: case 0x9E: case 0x9F:
+        return OP_NONE;
+    case 0xA0: case 0xA1: case 0xA2: case 0xA3:
+        return OP_SPECIAL;  // mov with memory offset
+    case 0xA8:  return OP_IMM8;
+    case 0xA9:  return OP_IMMZ;
+    case 0xC0: case 0xC1:
+        return ( OP_MODRM | OP_IMM8 );
+    case 0xC2:  return OP_IMM16;
+    case 0xC3:  return OP_NONE;
+    case 0xC4: case 0xC5:   // les/lds (VEX is handled by the caller)
+        return ( is64Bit ? OP_INVALID : OP_MODRM );
+    case 0xC6:  return ( OP_MODRM | OP_IMM8 );
+    case 0xC7:  return ( OP_MODRM | OP_IMMZ );
+    case 0xC8:  return ( OP_IMM16 | OP_IMM8 );  // enter
+    case 0xC9:  return OP_NONE;
+    case 0xCA:  return OP_IMM16;
+    case 0xCB: case 0xCC:
+        return OP_NONE;
+    case 0xCD:  return OP_IMM8;
+    case 0xCE:  return ( is64Bit ? OP_INVALID : OP_NONE );
+    case 0xCF:  return OP_NONE;
+    case 0xD0: case 0xD1: case 0xD2: case 0xD3:
+        return OP_MODRM;
+    case 0xD4: case 0xD5:
+        return ( is64Bit ? OP_INVALID : OP_IMM8 );
+    case 0xD6:  return OP_INVALID;
+    case 0xD7:  return OP_NONE;
+    case 0xE8: case 0xE9:
+        return OP_IMMZ;     // call/jmp rel
+    case 0xEA:  return ( is64Bit ? OP_INVALID : OP_SPECIAL );   // jmp far
+    case 0xEB:  return OP_IMM8;
+    case 0xEC: case 0xED: case 0xEE: case 0xEF:
+        return OP_NONE;
+    case 0xF1: case 0xF4: case 0xF5:
+        return OP_NONE;
+    case 0xF6: case 0xF7:
+        return OP_SPECIAL;  // test has an immediate, the other group members do not
+    case 0xF8: case 0xF9: case 0xFA: case 0xFB: case 0xFC: case 0xFD:
+        return OP_NONE;
+    case 0xFE: case 0xFF:
+        return OP_MODRM;
+    }
+
+    // 0x84 - 0x8F and 0xA4 - 0xAF (string operations) remain.
+    if ( op >= 0x84 && op <= 0x8F )     return OP_MODRM;
+    if ( op >= 0xA4 && op <= 0xAF )     return OP_NONE;
+
+    return OP_INVALID;
+}
+
+static unsigned char GetTwoByteOpcodeFlags( unsigned char op )
+{
+    if ( op >= 0x80 && op <= 0x8F )     return OP_IMMZ;     // jcc rel
+    if ( op >= 0xC8 && op <= 0xCF )     return OP_NONE;     // bswap
+
+    switch( op )
+    {
+    case 0x04: case 0x0A: case 0x0C:
+    case 0x36: case 0x39: case 0x3B: case 0x3C: case 0x3D: case 0x3E: case 0x3F:
+    case 0xA6: case 0xA7:
+        return OP_INVALID;
+    case 0x05: case 0x06: case 0x07: case 0x08: case 0x09: case 0x0B: case 0x0E:
+    case 0x30: case 0x31: case 0x32: case 0x33: case 0x34: case 0x35: case 0x37:
+    case 0x77:
+    case 0xA0: case 0xA1: case 0xA2: case 0xA8: case 0xA9: case 0xAA:
+        return OP_NONE;
+    case 0x0F:  // 3DNow! has its opcode as trailing byte
+    case 0x70: case 0x71: case 0x72: case 0x73:
+    case 0xA4: case 0xAC: case 0xBA:
+    case 0xC2: case 0xC4: case 0xC5: case 0xC6:
+        return ( OP_MODRM | OP_IMM8 );
+    }
+
+    return OP_MODRM;
+}
+
+// Opcode flags of VEX, EVEX and XOP encoded instructions, by opcode map.
+static unsigned char GetExtendedMapOpcodeFlags( unsigned int opMap, unsigned char op )
+{
+    if ( opMap == 1 )
+    {
+        if ( op == 0x77 )
+        {
+            return OP_NONE;     // vzeroupper, vzeroall
+        }
+
+        unsigned char flags = GetTwoByteOpcodeFlags( op );
+
+        if ( flags & OP_INVALID )
+        {
+            return OP_INVALID;
+        }
+
+        return ( OP_MODRM | ( flags & OP_IMM8 ) );
+    }
+    if ( opMap == 2 )       return OP_MODRM;
+    if ( opMap == 3 )       return ( OP_MODRM | OP_IMM8 );
+
+    return OP_INVALID;
+}
+
+// Returns the amount of bytes taken by the ModRM byte, SIB byte and displacement.
+static size_t GetModRMLength( const unsigned char *code, size_t codeSize, bool addr16Bit )
+{
+    if ( codeSize < 1 )
+    {
+        return 0;
+    }
+
+    unsigned char modrm = code[0];
+
+    unsigned char mod = ( modrm >> 6 );
+    unsigned char rm = ( modrm & 7 );
+
+    if ( mod == 3 )
+    {
+        return 1;
+    }
+
+    if ( addr16Bit )
+    {
+        if ( mod == 0 && rm == 6 )  return 3;
+        if ( mod == 1 )             return 2;
+        if ( mod == 2 )             return 3;
+
+        return 1;
+    }
+
+    size_t len = 1;
+
+    if ( rm == 4 )
+    {
+        if ( codeSize < 2 )
+        {
+            return 0;
+        }
+
+        unsigned char sib = code[1];
+
+        len++;
+
+        if ( mod == 0 && ( sib & 7 ) == 5 )
+        {
+            len += 4;
+        }
+    }
+    else if ( mod == 0 && rm == 5 )
+    {
+        // disp32 or RIP-relative.
+        len += 4;
+    }
+
+    if ( mod == 1 )         len += 1;
+    else if ( mod == 2 )    len += 4;
+
+    return len;
+}
+
+size_t GetX86InstructionLength( const unsigned char *code, size_t codeSize, bool is64Bit )
+{
+    // Architectural maximum length of an instruction.
+    const size_t maxLength = 15;
+
+    size_t limit = std::min( codeSize, maxLength );
+
+    size_t pos = 0;
+
+    bool opSize16 = false;
+    bool addrSizeOverride = false;
+    bool rexW = false;
+
+    // Legacy prefixes.
+    while ( pos < limit )
+    {
+        unsigned char c = code[pos];
+
+        if ( c == 0x66 )
+        {
+            opSize16 = true;
+        }
+        else if ( c == 0x67 )
+        {
+            addrSizeOverride = true;
+        }
+        else if ( c != 0x26 && c != 0x2E && c != 0x36 && c != 0x3E && c != 0x64 && c != 0x65 &&
+                  c != 0xF0 && c != 0xF2 && c != 0xF3 )
+        {
+            break;
+        }
+
+        pos++;
+    }
+
+    // REX prefix; only the last one before the opcode counts.
+    if ( is64Bit )
+    {
+        while ( pos < limit && ( code[pos] & 0xF0 ) == 0x40 )
+        {
+            rexW = ( code[pos] & 0x08 ) != 0;
+
+            pos++;
+        }
+    }
+
+    if ( pos >= limit )
+    {
+        return 0;
+    }
+
+    bool addr16Bit = ( is64Bit == false && addrSizeOverride );
+
+    unsigned char op = code[pos++];
+
+    unsigned char flags;
+
+    // Check for VEX, EVEX and XOP prefixes. In 32bit mode they overlap with les, lds, bound and pop,
+    // so they are only prefixes if the following byte could not be a memory ModRM.
+    bool isExtendedEncoding = false;
+
+    if ( ( op == 0xC4 || op == 0xC5 || op == 0x62 || op == 0x8F ) && pos < limit )
+    {
+        unsigned char next = code[pos];
+
+        if ( op == 0x8F )
+        {
+            isExtendedEncoding = ( ( next >> 3 ) & 7 ) != 0;
+        }
+        else
+        {
+            isExtendedEncoding = ( is64Bit || ( next & 0xC0 ) == 0xC0 );
+        }
+    }
+
+    if ( isExtendedEncoding )
+    {
+        unsigned int opMap;
+
+        if ( op == 0xC5 )
+        {
+            opMap = 1;
+            pos += 1;
+        }
+        else if ( op == 0x62 )
+        {
+            opMap = ( code[pos] & 3 );
+            pos += 3;
+        }
+        else
+        {
+            opMap = ( code[pos] & 0x1F );
+            pos += 2;
+        }
+
+        if ( pos >= limit )
+        {
+            return 0;
+        }
+
+        unsigned char extOp = code[pos++];
+
+        if ( op == 0x8F )
+        {
+            // XOP opcode maps.
+            if ( opMap == 8 )           flags = ( OP_MODRM | OP_IMM8 );
+            else if ( opMap == 9 )      flags = OP_MODRM;
+            else if ( opMap == 10 )     flags = ( OP_MODRM | OP_IMMZ );
+            else                        return 0;
+
+            // XOP immediates are never 16bit.
+            opSize16 = false;
+        }
+        else
+        {
+            flags = GetExtendedMapOpcodeFlags( opMap, extOp );
+        }
+    }
+    else if ( op == 0x0F )
+    {
+        if ( pos >= limit )
+        {
+            return 0;
+        }
+
+        unsigned char op2 = code[pos++];
+
+        if ( op2 == 0x38 || op2 == 0x3A )
+        {
+            // Three-byte opcodes.
+            if ( pos >= limit )
+            {
+                return 0;
+            }
+
+            pos++;
+
+            flags = ( op2 == 0x3A ? ( OP_MODRM | OP_IMM8 ) : OP_MODRM );
+        }
+        else
+        {
+            flags = GetTwoByteOpcodeFlags( op2 );
+        }
+    }
+    else
+    {
+        flags = GetOneByteOpcodeFlags( op, is64Bit );
+    }
+
+    if ( flags & OP_INVALID )
+    {
+        return 0;
+    }
+
+    size_t immSize = 0;
+
+    if ( flags & OP_SPECIAL )
+    {
+        if ( op >= 0xB8 && op <= 0xBF )
+        {
+            immSize = ( rexW ? 8 : ( opSize16 ? 2 : 4 ) );
+        }
+        else if ( op >= 0xA0 && op <= 0xA3 )
+        {
+            if ( is64Bit )
+            {
+                immSize = ( addrSizeOverride ? 4 : 8 );
+            }
+            else
+            {
+                immSize = ( addrSizeOverride ? 2 : 4 );
+            }
+        }
+        else if ( op == 0x9A || op == 0xEA )
+        {
+            immSize = ( opSize16 ? 4 : 6 );
+        }
+        else if ( op == 0xF6 || op == 0xF7 )
+        {
+            if ( pos >= limit )
+            {
+                return 0;
+            }
+
+            // Only test (/0 and /1) carries an immediate.
+            unsigned char reg = ( ( code[pos] >> 3 ) & 7 );
+
+            if ( reg < 2 )
+            {
+                immSize = ( op == 0xF6 ? 1 : ( opSize16 ? 2 : 4 ) );
+            }
+
+            flags |= OP_MODRM;
+        }
+    }
+
+    if ( flags & OP_MODRM )
+    {
+        size_t modrmLen = GetModRMLength( code + pos, limit - pos, addr16Bit );
+
+        if ( modrmLen == 0 )
+        {
+            return 0;
+        }
+
+        pos += modrmLen;
+    }
+
+    if ( flags & OP_IMM8 )      immSize += 1;
+    if ( flags & OP_IMM16 )     immSize += 2;
+    if ( flags & OP_IMMZ )      immSize += ( opSize16 ? 2 : 4 );
+
+    pos += immSize;
+
+    if ( pos > limit )
+    {
+        return 0;
+    }
+
+    return pos;
+}
+
+void InstructionStartIndex::Build( const void *code, size_t codeSize, bool is64Bit, std::vector <std::uint32_t> seedOffsets )
+{
+    const unsigned char *codeBytes = (const unsigned char*)code;
+
+    this->codeSize = codeSize;
+    this->bitmap.assign( ( codeSize + 63 ) / 64, 0 );
+    this->syncedInnerBitmap.assign( ( codeSize + 63 ) / 64, 0 );
+
+    std::sort( seedOffsets.begin(), seedOffsets.end() );
+
+    size_t seedIdx = 0;
+    size_t numSeeds = seedOffsets.size();
+
+    size_t pos = 0;
+    bool isSynced = false;
+
+    while ( pos < codeSize )
+    {
+        // Skip seeds that we have already passed by.
+        while ( seedIdx < numSeeds && seedOffsets[ seedIdx ] < pos )
+        {
+            seedIdx++;
+        }
+
+        if ( seedIdx < numSeeds && seedOffsets[ seedIdx ] == pos )
+        {
+            isSynced = true;
+        }
+
+        size_t insnLen = GetX86InstructionLength( codeBytes + pos, codeSize - pos, is64Bit );
+
+        if ( insnLen == 0 )
+        {
+            // Not code; try the next byte.
+            isSynced = false;
+            pos++;
+            continue;
+        }
+
+        size_t nextPos = ( pos + insnLen );
+
+        // If the instruction overlaps a seed, then we are decoding out of sync.
+        // Trust the seed and continue decoding from there.
+        if ( seedIdx < numSeeds && seedOffsets[ seedIdx ] > pos && seedOffsets[ seedIdx ] < nextPos )
+        {
+            pos = seedOffsets[ seedIdx ];
+            continue;
+        }
+
+        this->bitmap[ pos / 64 ] |= ( 1ull << ( pos % 64 ) );
+
+        if ( isSynced )
+        {
+            for ( size_t innerPos = pos + 1; innerPos < nextPos; innerPos++ )
+            {
+                this->syncedInnerBitmap[ innerPos / 64 ] |= ( 1ull << ( innerPos % 64 ) );
+            }
+        }
+
+        pos = nextPos;
+    }
+}
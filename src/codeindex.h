@@ -0,0 +1,51 @@
+#ifndef _CODE_INSTRUCTION_INDEX_
+#define _CODE_INSTRUCTION_INDEX_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Returns the length of the x86 or x64 instruction at code, or zero if it could not be decoded.
+// Only the length is determined, not the meaning of the instruction.
+size_t GetX86InstructionLength( const unsigned char *code, size_t codeSize, bool is64Bit );
+
+// Bitmap of instruction starts inside of a block of machine code.
+// Patchers use it to tell byte pattern matches in the middle of other instructions
+// apart from real instructions.
+struct InstructionStartIndex
+{
+    // Decodes the code in one linear pass. Decoding starts at the beginning and is
+    // resynchronized at every seed offset (known function starts, branch targets, etc).
+    // Instructions count as in sync from a seed up to the first byte that cannot be decoded.
+    void Build( const void *code, size_t codeSize, bool is64Bit, std::vector <std::uint32_t> seedOffsets );
+
+    inline bool IsInstructionStart( size_t offset ) const
+    {
+        if ( offset >= this->codeSize )
+        {
+            return false;
+        }
+
+        return ( this->bitmap[ offset / 64 ] & ( 1ull << ( offset % 64 ) ) ) != 0;
+    }
+
+    // Returns true if the offset lies behind the first byte of an instruction that was
+    // decoded in sync. Data inside of code can desync the decoding, so an offset that is
+    // no instruction start is not necessarily inside of another instruction.
+    inline bool IsInsideSyncedInstruction( size_t offset ) const
+    {
+        if ( offset >= this->codeSize )
+        {
+            return false;
+        }
+
+        return ( this->syncedInnerBitmap[ offset / 64 ] & ( 1ull << ( offset % 64 ) ) ) != 0;
+    }
+
+private:
+    std::vector <std::uint64_t> bitmap;
+    std::vector <std::uint64_t> syncedInnerBitmap;
+    size_t codeSize = 0;
+};
+
+#endif //_CODE_INSTRUCTION_INDEX_
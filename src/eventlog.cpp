@@ -0,0 +1,269 @@
+#include "eventlog.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <share.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#endif //_WIN32
+
+static void AppendJSONString( std::string& json, const char *value )
+{
+    json += '"';
+
+    while ( char c = *value++ )
+    {
+        switch( c )
+        {
+        case '"':   json += "\\\""; break;
+        case '\\':  json += "\\\\"; break;
+        case '\n':  json += "\\n"; break;
+        case '\r':  json += "\\r"; break;
+        case '\t':  json += "\\t"; break;
+        default:
+            if ( (unsigned char)c < 0x20 )
+            {
+                char escBuf[ 8 ];
+                snprintf( escBuf, sizeof(escBuf), "\\u%04x", (unsigned int)c );
+
+                json += escBuf;
+            }
+            else
+            {
+                json += c;
+            }
+            break;
+        }
+    }
+
+    json += '"';
+}
+
+static int OpenEventFile( const char *path )
+{
+#ifdef _WIN32
+    int fd = -1;
+
+    _sopen_s( &fd, path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _SH_DENYNO, _S_IREAD | _S_IWRITE );
+
+    return fd;
+#else
+    return open( path, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+#endif //_WIN32
+}
+
+static bool WriteEventData( int fd, const char *data, size_t dataSize )
+{
+    while ( dataSize > 0 )
+    {
+#ifdef _WIN32
+        int written = _write( fd, data, (unsigned int)dataSize );
+#else
+        ssize_t written = write( fd, data, dataSize );
+#endif //_WIN32
+
+        if ( written <= 0 )
+        {
+            return false;
+        }
+
+        data += written;
+        dataSize -= (size_t)written;
+    }
+
+    return true;
+}
+
+static void CloseEventFile( int fd )
+{
+#ifdef _WIN32
+    _close( fd );
+#else
+    close( fd );
+#endif //_WIN32
+}
+
+void EventLog::fields::AddKey( const char *key )
+{
+    this->json += ',';
+
+    AppendJSONString( this->json, key );
+
+    this->json += ':';
+}
+
+EventLog::fields& EventLog::fields::AddString( const char *key, const char *value )
+{
+    AddKey( key );
+    AppendJSONString( this->json, value );
+
+    return *this;
+}
+
+EventLog::fields& EventLog::fields::AddNumber( const char *key, std::int64_t value )
+{
+    AddKey( key );
+
+    this->json += std::to_string( value );
+
+    return *this;
+}
+
+EventLog::fields& EventLog::fields::AddBool( const char *key, bool value )
+{
+    AddKey( key );
+
+    this->json += ( value ? "true" : "false" );
+
+    return *this;
+}
+
+EventLog::EventLog( void )
+{
+    this->fileDesc = -1;
+    this->ownsFileDesc = false;
+    this->startTime = std::chrono::steady_clock::now();
+    this->isClosing = false;
+}
+
+EventLog::~EventLog( void )
+{
+    Close();
+}
+
+bool EventLog::Open( const char *target )
+{
+    if ( IsOpen() )
+    {
+        return false;
+    }
+
+    // A target made of digits only is a descriptor that was handed to us.
+    const char *digitIter = target;
+
+    while ( *digitIter >= '0' && *digitIter <= '9' )
+    {
+        digitIter++;
+    }
+
+    if ( *target != '\0' && *digitIter == '\0' )
+    {
+        this->fileDesc = atoi( target );
+        this->ownsFileDesc = false;
+    }
+    else
+    {
+        this->fileDesc = OpenEventFile( target );
+        this->ownsFileDesc = true;
+
+        if ( this->fileDesc == -1 )
+        {
+            return false;
+        }
+    }
+
+#ifndef _WIN32
+    // A reader that goes away must not end the run.
+    signal( SIGPIPE, SIG_IGN );
+#endif //_WIN32
+
+    this->isClosing = false;
+    this->writerThread = std::thread( WriterThreadProc, this );
+
+    return true;
+}
+
+void EventLog::Close( void )
+{
+    if ( !IsOpen() )
+    {
+        return;
+    }
+
+    {
+        std::unique_lock <std::mutex> lock( this->pendingLock );
+
+        this->isClosing = true;
+    }
+
+    this->pendingCond.notify_one();
+
+    this->writerThread.join();
+
+    if ( this->ownsFileDesc )
+    {
+        CloseEventFile( this->fileDesc );
+    }
+
+    this->fileDesc = -1;
+}
+
+void EventLog::Emit( const char *eventName, const fields& eventFields )
+{
+    if ( !IsOpen() )
+    {
+        return;
+    }
+
+    long long msSinceStart = (long long)std::chrono::duration_cast <std::chrono::milliseconds> ( std::chrono::steady_clock::now() - this->startTime ).count();
+
+    std::string line = "{\"job\":";
+
+    AppendJSONString( line, this->jobId.c_str() );
+
+    line += ",\"event\":";
+
+    AppendJSONString( line, eventName );
+
+    line += ",\"ms\":";
+    line += std::to_string( msSinceStart );
+    line += eventFields.json;
+    line += "}\n";
+
+    {
+        std::unique_lock <std::mutex> lock( this->pendingLock );
+
+        this->pendingData += line;
+    }
+
+    this->pendingCond.notify_one();
+}
+
+void EventLog::WriterThreadProc( EventLog *log )
+{
+    std::string writeData;
+    bool canWrite = true;
+
+    while ( true )
+    {
+        bool isClosing;
+        {
+            std::unique_lock <std::mutex> lock( log->pendingLock );
+
+            log->pendingCond.wait( lock, [&]{ return ( log->isClosing || log->pendingData.empty() == false ); } );
+
+            writeData.clear();
+            writeData.swap( log->pendingData );
+
+            isClosing = log->isClosing;
+        }
+
+        // If the reader went away we keep draining so that the run is not held up.
+        if ( canWrite && writeData.empty() == false )
+        {
+            canWrite = WriteEventData( log->fileDesc, writeData.data(), writeData.size() );
+        }
+
+        if ( isClosing )
+        {
+            break;
+        }
+    }
+}
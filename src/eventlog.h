@@ -0,0 +1,64 @@
+#ifndef _RUN_EVENT_LOG_
+#define _RUN_EVENT_LOG_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Machine-readable progress and diagnostics of a run, written as NDJSON (one JSON object
+// per line) to a file descriptor or a file. Every event carries the job id, its name and
+// the milliseconds since the start of the run. Events are collected in memory and written
+// by a background thread, so reporting does not wait for the reader.
+struct EventLog
+{
+    EventLog( void );
+    ~EventLog( void );
+
+    // The target is either the number of an open file descriptor or a file path.
+    bool Open( const char *target );
+
+    // Writes all pending events and stops the writer thread.
+    void Close( void );
+
+    inline bool IsOpen( void ) const                        { return ( this->fileDesc != -1 ); }
+
+    inline void SetJobId( const char *jobId )               { this->jobId = jobId; }
+
+    // Fields of one event, in the order they were added.
+    struct fields
+    {
+        fields& AddString( const char *key, const char *value );
+        fields& AddNumber( const char *key, std::int64_t value );
+        fields& AddBool( const char *key, bool value );
+
+    private:
+        friend struct EventLog;
+
+        void AddKey( const char *key );
+
+        std::string json;
+    };
+
+    void Emit( const char *eventName, const fields& eventFields = fields() );
+
+private:
+    static void WriterThreadProc( EventLog *log );
+
+    int fileDesc;
+    bool ownsFileDesc;
+
+    std::string jobId;
+
+    std::chrono::steady_clock::time_point startTime;
+
+    std::thread writerThread;
+    std::mutex pendingLock;
+    std::condition_variable pendingCond;
+    std::string pendingData;
+    bool isClosing;
+};
+
+#endif //_RUN_EVENT_LOG_
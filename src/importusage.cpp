@@ -0,0 +1,205 @@
+#include "importusage.h"
+
+#include <algorithm>
+#include <cstring>
+
+void ImportUsageAnalysis::MarkReference( std::uint32_t targetRVA )
+{
+    if ( targetRVA < this->minSlotRVA || targetRVA >= this->maxSlotEndRVA )
+    {
+        return;
+    }
+
+    // Find the last IAT that starts at or before the target.
+    auto foundIter = std::upper_bound( this->sortedSlots.begin(), this->sortedSlots.end(), targetRVA,
+        [&]( std::uint32_t rva, size_t slotsIndex )
+    {
+        return ( rva < this->descSlots[ slotsIndex ].iatRVA );
+    });
+
+    if ( foundIter == this->sortedSlots.begin() )
+    {
+        return;
+    }
+
+    slots& iatSlots = this->descSlots[ *( foundIter - 1 ) ];
+
+    std::uint32_t iatOffset = ( targetRVA - iatSlots.iatRVA );
+
+    if ( iatOffset >= iatSlots.iatSize )
+    {
+        return;
+    }
+
+    std::vector <bool>::reference isUsed = iatSlots.usedSlots[ iatOffset / this->slotSize ];
+
+    if ( !isUsed )
+    {
+        isUsed = true;
+
+        this->numUnusedSlots--;
+    }
+}
+
+void ImportUsageAnalysis::Analyze( PEFile& moduleImage, std::uint32_t archPointerSize )
+{
+    this->slotSize = archPointerSize;
+    this->minSlotRVA = 0xFFFFFFFF;
+    this->maxSlotEndRVA = 0;
+    this->numUnusedSlots = 0;
+
+    // We only know how x86 and x64 code addresses memory.
+    std::uint16_t machineType = moduleImage.pe_finfo.machine_id;
+
+    bool isKnownMachine = ( machineType == PEL_IMAGE_FILE_MACHINE_I386 || machineType == PEL_IMAGE_FILE_MACHINE_AMD64 );
+
+    size_t numDescs = moduleImage.imports.GetCount();
+
+    this->descSlots.resize( numDescs );
+    this->sortedSlots.clear();
+
+    for ( size_t n = 0; n < numDescs; n++ )
+    {
+        const PEFile::PEImportDesc& impDesc = moduleImage.imports[ n ];
+
+        slots& iatSlots = this->descSlots[ n ];
+
+        size_t numFuncs = impDesc.funcs.GetCount();
+
+        // Otherwise we cannot tell, so everything is kept.
+        if ( isKnownMachine == false || impDesc.firstThunkRef.GetSection() == nullptr )
+        {
+            iatSlots.iatRVA = 0;
+            iatSlots.iatSize = 0;
+            iatSlots.usedSlots.assign( numFuncs, true );
+            continue;
+        }
+
+        iatSlots.iatRVA = impDesc.firstThunkRef.GetRVA();
+        iatSlots.iatSize = (std::uint32_t)( numFuncs * archPointerSize );
+        iatSlots.usedSlots.assign( numFuncs, false );
+
+        this->numUnusedSlots += numFuncs;
+
+        this->minSlotRVA = std::min( this->minSlotRVA, iatSlots.iatRVA );
+        this->maxSlotEndRVA = std::max( this->maxSlotEndRVA, iatSlots.iatRVA + iatSlots.iatSize );
+
+        this->sortedSlots.push_back( n );
+    }
+
+    std::sort( this->sortedSlots.begin(), this->sortedSlots.end(),
+        [&]( size_t left, size_t right )
+    {
+        return ( this->descSlots[ left ].iatRVA < this->descSlots[ right ].iatRVA );
+    });
+
+    if ( this->numUnusedSlots == 0 )
+    {
+        return;
+    }
+
+    std::uint64_t imageBase = moduleImage.GetImageBase();
+
+    auto markAbsoluteReference = [&]( std::uint64_t va )
+    {
+        if ( va >= imageBase && ( va - imageBase ) <= 0xFFFFFFFF )
+        {
+            this->MarkReference( (std::uint32_t)( va - imageBase ) );
+        }
+    };
+
+    if ( moduleImage.HasRelocationInfo() )
+    {
+        // Every absolute address inside of the module has a base relocation.
+        for ( PEFile::PEBaseRelocStore::page relocPage : moduleImage.baseRelocs )
+        {
+            std::uint32_t relocChunkOffset = relocPage.GetPageRVA();
+
+            for ( const PEFile::PEBaseReloc::item& relocItem : relocPage )
+            {
+                std::uint32_t relocSectOffset;
+                PEFile::PESection *relocSect = moduleImage.FindSectionByRVA( relocChunkOffset + relocItem.offset, nullptr, &relocSectOffset );
+
+                if ( relocSect == nullptr )
+                    continue;
+
+                PEFile::PEBaseReloc::eRelocType relocType = (PEFile::PEBaseReloc::eRelocType)relocItem.type;
+
+                if ( relocType == PEFile::PEBaseReloc::eRelocType::HIGHLOW && relocSect->HasDataRange( relocSectOffset, sizeof(std::uint32_t) ) )
+                {
+                    markAbsoluteReference( relocSect->ReadValueUnchecked <std::uint32_t> ( relocSectOffset ) );
+                }
+                else if ( relocType == PEFile::PEBaseReloc::eRelocType::DIR64 && relocSect->HasDataRange( relocSectOffset, sizeof(std::uint64_t) ) )
+                {
+                    markAbsoluteReference( relocSect->ReadValueUnchecked <std::uint64_t> ( relocSectOffset ) );
+                }
+            }
+        }
+    }
+    else
+    {
+        // Any pointer-sized value could be an absolute address.
+        PEFile::sectionIter_t iter = moduleImage.GetSectionIterator();
+
+        for ( ; !iter.IsEnd() && this->numUnusedSlots != 0; iter.Increment() )
+        {
+            PEFile::PESection *theSect = iter.Resolve();
+
+            const unsigned char *sectData = (const unsigned char*)theSect->stream.Data();
+            size_t sectDataSize = (size_t)theSect->stream.Size();
+
+            for ( size_t off = 0; off + archPointerSize <= sectDataSize; off++ )
+            {
+                if ( archPointerSize == 8 )
+                {
+                    std::uint64_t value;
+                    memcpy( &value, sectData + off, sizeof(value) );
+
+                    markAbsoluteReference( value );
+                }
+                else
+                {
+                    std::uint32_t value;
+                    memcpy( &value, sectData + off, sizeof(value) );
+
+                    markAbsoluteReference( value );
+                }
+            }
+        }
+    }
+
+    if ( archPointerSize == 8 )
+    {
+        // RIP-relative displacements are relative to the end of the instruction. The displacement
+        // can be followed by an immediate of up to four bytes.
+        const std::uint32_t immSizes[] = { 0, 1, 2, 4 };
+
+        PEFile::sectionIter_t iter = moduleImage.GetSectionIterator();
+
+        for ( ; !iter.IsEnd() && this->numUnusedSlots != 0; iter.Increment() )
+        {
+            PEFile::PESection *theSect = iter.Resolve();
+
+            if ( theSect->chars.sect_mem_execute == false && theSect->chars.sect_containsCode == false )
+                continue;
+
+            const unsigned char *sectData = (const unsigned char*)theSect->stream.Data();
+            size_t sectDataSize = (size_t)theSect->stream.Size();
+
+            std::uint32_t sectRVA = theSect->GetVirtualAddress();
+
+            for ( size_t off = 0; off + sizeof(std::int32_t) <= sectDataSize; off++ )
+            {
+                std::int32_t disp;
+                memcpy( &disp, sectData + off, sizeof(disp) );
+
+                std::uint32_t dispEndRVA = ( sectRVA + (std::uint32_t)off + sizeof(disp) );
+
+                for ( std::uint32_t immSize : immSizes )
+                {
+                    this->MarkReference( dispEndRVA + immSize + (std::uint32_t)disp );
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef _IMPORT_USAGE_ANALYSIS_
+#define _IMPORT_USAGE_ANALYSIS_
+
+#include <peframework.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Finds the import address table slots of a module that are referenced by the module itself.
+// Absolute pointers to slots are found through the base relocations of the module. On x64 code
+// addresses slots RIP-relative, so executable sections are also scanned for displacements
+// that could reach a slot. Anything that could be a reference keeps its slot.
+struct ImportUsageAnalysis
+{
+    void Analyze( PEFile& moduleImage, std::uint32_t archPointerSize );
+
+    inline bool IsSlotUsed( size_t descIndex, size_t funcIndex ) const
+    {
+        return this->descSlots[ descIndex ].usedSlots[ funcIndex ];
+    }
+
+    inline size_t GetUnusedSlotCount( void ) const      { return this->numUnusedSlots; }
+
+private:
+    void MarkReference( std::uint32_t targetRVA );
+
+    struct slots
+    {
+        std::uint32_t iatRVA;
+        std::uint32_t iatSize;
+        std::vector <bool> usedSlots;
+    };
+
+    // Parallel to the import descriptors of the module.
+    std::vector <slots> descSlots;
+
+    // Indices into descSlots, sorted by IAT address.
+    std::vector <size_t> sortedSlots;
+
+    std::uint32_t slotSize = 0;
+    std::uint32_t minSlotRVA = 0;
+    std::uint32_t maxSlotEndRVA = 0;
+
+    size_t numUnusedSlots = 0;
+};
+
+#endif //_IMPORT_USAGE_ANALYSIS_
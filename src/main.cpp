@@ -10,13 +10,28 @@
 
 #include <fstream>
 #include <list>
+#include <filesystem>
 #include <vector>
+#include <memory>
+#include <cstdio>
 
 #include <asmjitshared.h>
 
 #include <sdk/UniChar.h>
 
 #include "option.h"
+#include "mapfile.h"
+#include "prefetchstream.h"
+#include "mappedstream.h"
+#include "codeindex.h"
+#include "arenacache.h"
+#include "starthints.h"
+#include "importusage.h"
+#include "modarchive.h"
+#include "modmanifest.h"
+#include "eventlog.h"
+
+#include "peloader.freg.x64.h"
 
 // We need PE image structures due to Win32 image loading behavior.
 #include "peloader.serialize.h"
@@ -24,6 +39,29 @@
 // Some macros we need.
 #define _PAGE_READWRITE     0x04
 
+// Startup profiling table that is written by the generated entry stub if requested.
+// It is exported from the executable under the name below so that debuggers, crash reporters
+// or the host application can find it. Timestamps are raw rdtsc values.
+#define STUB_PROFILE_EXPORT_NAME    "dll2exe_stubProfile"
+#define STUB_PROFILE_VERSION        1
+
+struct stubProfileHeader
+{
+    char magic[8];                  // "D2XSPROF"
+    std::uint32_t version;
+    std::uint32_t numEntries;
+    std::uint32_t entrySize;
+    std::uint32_t reserved;
+};
+
+struct stubProfileEntry
+{
+    char moduleName[40];            // zero-terminated, possibly truncated
+    std::uint64_t tscInitBegin;     // before the TLS callbacks
+    std::uint64_t tscTLSEnd;        // after the TLS callbacks, before the DLL entry point
+    std::uint64_t tscInitEnd;       // after the DLL entry point
+};
+
 struct runtime_exception
 {
     inline runtime_exception( int error_code, const char *msg )
@@ -113,6 +151,67 @@ inline void BufferPatternFind(
     }
 }
 
+// Collects offsets into a code section of a module that are known to be instruction starts.
+// These are used to seed the instruction decoder.
+static void CollectInstructionSeeds( PEFile& moduleImage, const PEFile::PERelocTargetIndex& relocIndex, PEFile::PESection *codeSect, std::vector <std::uint32_t>& seedsOut )
+{
+    std::uint32_t sectRVA = codeSect->GetVirtualAddress();
+    std::uint32_t sectSize = codeSect->GetVirtualSize();
+
+    auto addSeedRVA = [&]( std::uint32_t rva )
+    {
+        if ( rva >= sectRVA && ( rva - sectRVA ) < sectSize )
+        {
+            seedsOut.push_back( rva - sectRVA );
+        }
+    };
+
+    // The entry point.
+    addSeedRVA( moduleImage.peOptHeader.addressOfEntryPointRef.GetRVA() );
+
+    // All exported functions.
+    for ( const PEFile::PEExportDir::func& expFunc : moduleImage.exportDir.functions )
+    {
+        if ( expFunc.isForwarder == false && expFunc.expRef.GetSection() == codeSect )
+        {
+            seedsOut.push_back( expFunc.expRef.GetSectionOffset() );
+        }
+    }
+
+    // Function table entries of x64 images.
+    if ( auto *fregNode = moduleImage.genDataDirs.entries.Find( PEL_IMAGE_DIRECTORY_ENTRY_EXCEPTION ) )
+    {
+        std::uint16_t machineType = moduleImage.pe_finfo.machine_id;
+
+        if ( machineType == PEL_IMAGE_FILE_MACHINE_AMD64 )
+        {
+            const PEFileDetails::PEFunctionRegistryX64 *funcRegistry = (const PEFileDetails::PEFunctionRegistryX64*)fregNode->GetValue();
+
+            for ( const auto& func : funcRegistry->compactEntries )
+            {
+                addSeedRVA( funcRegistry->ResolveCompactRVA( func.beginAddr ) );
+            }
+
+            for ( const PEFileDetails::PERuntimeFunctionX64& func : funcRegistry->entries )
+            {
+                addSeedRVA( func.beginAddrRef.GetRVA() );
+            }
+        }
+    }
+
+    // Pointers that are fixed up by relocations and point into the code are usually
+    // function pointers or jump table targets.
+    {
+        const PEFile::PERelocTargetIndex::reference *firstRef;
+        size_t numRefs = relocIndex.FindReferences( sectRVA, sectSize, firstRef );
+
+        for ( size_t n = 0; n < numRefs; n++ )
+        {
+            addSeedRVA( firstRef[ n ].targetRVA );
+        }
+    }
+}
+
 // Embed a directory entry into the executable.
 struct resourceHelpers
 {
@@ -140,7 +239,7 @@ struct resourceHelpers
 
             if ( !resItem )
             {
-                std::wcout << L"* merging resource tree '" << newPath.GetConstString() << L"'" << std::endl;
+                std::wcout << L"* merging resource tree '" << newPath.GetConstString() << L"'" << '\n';
 
                 // Create it if not there yet.
                 resItem = CloneResourceItem( sectResolver, embedItem );
@@ -188,7 +287,7 @@ struct resourceHelpers
                 if ( wantsReplace )
                 {
                     // Give a warning to the user that we replace a resource.
-                    std::wcout << L"* replacing resource item '" << newPath.GetConstString() << L"'" << std::endl;
+                    std::wcout << L"* replacing resource item '" << newPath.GetConstString() << L"'" << '\n';
 
                     hasChanged = true;
 
@@ -294,19 +393,63 @@ struct resourceHelpers
     }
 };
 
-static void WriteVirtualAddress( PEFile& image, PEFile::PESection *targetSect, std::uint32_t sectOffset, std::uint64_t virtualAddress, std::uint32_t archPointerSize, bool requiresRelocations )
+// Values inside of the stored section data are accessed directly; only values at
+// the edge of the data go through the section stream.
+template <typename numberType>
+static inline bool ReadSectionValue( PEFile::PESection *sect, std::uint32_t sectOffset, numberType& valueOut )
 {
-    std::uint32_t itemRVA = ( targetSect->GetVirtualAddress() + sectOffset );
+    if ( sect->HasDataRange( sectOffset, sizeof(numberType) ) )
+    {
+        valueOut = sect->ReadValueUnchecked <numberType> ( sectOffset );
+        return true;
+    }
+
+    endian::little_endian <numberType> val_le;
+
+    sect->stream.Seek( (std::int32_t)sectOffset );
+
+    if ( !sect->stream.ReadStruct( val_le ) )
+    {
+        return false;
+    }
+
+    valueOut = val_le;
+    return true;
+}
+
+template <typename numberType>
+static inline void WriteSectionValue( PEFile::PESection *sect, std::uint32_t sectOffset, numberType value )
+{
+    if ( sect->HasDataRange( sectOffset, sizeof(numberType) ) )
+    {
+        sect->WriteValueUnchecked <numberType> ( sectOffset, value );
+        return;
+    }
 
-    targetSect->stream.Seek( sectOffset );
+    sect->stream.Seek( (std::int32_t)sectOffset );
+    sect->stream.WriteStruct( endian::little_endian <numberType> ( value ) );
+}
+
+// isStoredRange tells that the caller has validated the write against the stored section data.
+static void WriteVirtualAddress( PEFile& image, PEFile::PESection *targetSect, std::uint32_t sectOffset, std::uint64_t virtualAddress, std::uint32_t archPointerSize, bool requiresRelocations, bool isStoredRange )
+{
+    std::uint32_t itemRVA = ( targetSect->GetVirtualAddress() + sectOffset );
 
-    if ( archPointerSize == 4 )
+    if ( archPointerSize == 4 && isStoredRange )
+    {
+        targetSect->WriteValueUnchecked <std::uint32_t> ( sectOffset, (std::uint32_t)( virtualAddress ) );
+    }
+    else if ( archPointerSize == 8 && isStoredRange )
+    {
+        targetSect->WriteValueUnchecked <std::uint64_t> ( sectOffset, virtualAddress );
+    }
+    else if ( archPointerSize == 4 )
     {
-        targetSect->stream.WriteUInt32( (std::uint32_t)( virtualAddress ) );
+        WriteSectionValue( targetSect, sectOffset, (std::uint32_t)( virtualAddress ) );
     }
     else if ( archPointerSize == 8 )
     {
-        targetSect->stream.WriteUInt64( virtualAddress );
+        WriteSectionValue( targetSect, sectOffset, virtualAddress );
     }
     else
     {
@@ -396,6 +539,14 @@ static inline bool InjectImportsWithExports(
     PEFile::PEImportDesc::functions_t& impFuncs = splitOperator.GetImportFunctions();
     PEFile::PESectionDataReference& firstThunkRef = splitOperator.GetFirstThunkRef();
 
+    // Splitting only ever shrinks the thunk table from either end, so every thunk that we write
+    // lies inside of the table as it is now. Check once whether it is inside of the stored data.
+    PEFile::PESection *iatSect = firstThunkRef.GetSection();
+    std::uint32_t iatStartOffset = firstThunkRef.GetSectionOffset();
+    std::uint32_t iatEndOffset = ( iatStartOffset + (std::uint32_t)( archPointerSize * impFuncs.GetCount() ) );
+
+    bool isIATStored = ( iatSect != nullptr && iatSect->HasDataRange( iatStartOffset, iatEndOffset - iatStartOffset ) );
+
     // Check if any entry of this import directory is hosted by any export entry.
     size_t impFuncIter = 0;
 
@@ -422,13 +573,13 @@ static inline bool InjectImportsWithExports(
             // Keep track of change count.
             if ( isOrdinalMatch )
             {
-                std::cout << "* by ordinal " << ordinalOfImport << std::endl;
+                std::cout << "* by ordinal " << ordinalOfImport << '\n';
 
                 numOrdinalMatches++;
             }
             else
             {
-                std::cout << "* by name " << nameOfImport.GetConstString() << std::endl;
+                std::cout << "* by name " << nameOfImport.GetConstString() << '\n';
 
                 numNameMatches++;
             }
@@ -448,7 +599,12 @@ static inline bool InjectImportsWithExports(
 
                 std::uint32_t thunkSectOffset = ( firstThunkRef.GetSectionOffset() + thunkTableOffset );
 
-                WriteVirtualAddress( image, thunkSect, thunkSectOffset, exeImageFuncVA, archPointerSize, requiresRelocations );
+                bool isStoredThunk = (
+                    isIATStored && thunkSect == iatSect &&
+                    thunkSectOffset >= iatStartOffset && thunkSectOffset + archPointerSize <= iatEndOffset
+                );
+
+                WriteVirtualAddress( image, thunkSect, thunkSectOffset, exeImageFuncVA, archPointerSize, requiresRelocations, isStoredThunk );
             }
 
             // Perform the split operation.
@@ -562,10 +718,43 @@ struct AssemblyEnvironment
     // into the image, finally.
     std::list <PEFile::PESectionAllocation> persistentAllocations;
 
+    // Optional address map that receives the final locations of embedded module items.
+    ImageAddressMap *addrMap;
+
+    // RVA of the startup profiling entry of the module that is being embedded.
+    // Zero if no profiling code should be generated.
+    std::uint32_t stubProfileEntryRVA;
+
+    // Optional cache of relocated module arenas, along with the content hash of the module
+    // that is being embedded.
+    ModuleArenaCache *arenaCache;
+    std::uint64_t moduleContentHash;
+
+    // Optional collection of the pages that are touched during startup.
+    StartupPageHints *startHints;
+
     inline AssemblyEnvironment( PEFile& embedImage, asmjit::CodeHolder *codeHolder )
         : x86_asm( codeHolder ), embedImage( embedImage )
     {
-        return;
+        this->addrMap = nullptr;
+        this->stubProfileEntryRVA = 0;
+        this->arenaCache = nullptr;
+        this->moduleContentHash = 0;
+        this->startHints = nullptr;
+    }
+
+    // Stores the current time-stamp counter into a field of the startup profiling entry.
+    inline void EmitStubProfileTimestamp( std::uint32_t fieldOffset )
+    {
+        std::uint32_t rvaTarget = this->stubProfileEntryRVA;
+
+        if ( rvaTarget == 0 )
+            return;
+
+        x86_asm.rdtsc();
+        x86_asm.mov( x86_asm.zcx(), asmjit::Imm( rvaTarget + fieldOffset, true ) );
+        x86_asm.mov( asmjit::X86Mem( x86_asm.zcx(), 0, 4 ), asmjit::x86::eax );
+        x86_asm.mov( asmjit::X86Mem( x86_asm.zcx(), 4, 4 ), asmjit::x86::edx );
     }
 
     inline ~AssemblyEnvironment( void )
@@ -575,8 +764,7 @@ struct AssemblyEnvironment
 
     inline int EmbedModuleIntoExecutable(
         PEFile& moduleImage, bool requiresRelocations, const char *moduleImageName,
-        bool injectMatchingImports, bool doTakeoverExports, bool doIgnoreResources, bool doFixEntrypointExecutable, bool markAllSectionsExecutable,
-        std::uint32_t archPointerSize
+        const ModuleEmbedOptions& options, std::uint32_t archPointerSize
     )
     {
         PEFile& exeImage = this->embedImage;
@@ -586,7 +774,7 @@ struct AssemblyEnvironment
         // Check that the module is a DLL.
         if ( moduleImage.pe_finfo.isDLL != true )
         {
-            std::cout << "provided DLL image is not a DLL image" << std::endl;
+            std::cout << "provided DLL image is not a DLL image" << '\n';
 
             return -6;
         }
@@ -602,7 +790,7 @@ struct AssemblyEnvironment
         {
             if ( moduleImage.HasRelocationInfo() == false )
             {
-                std::cout << "DLL image is not relocatable (x86 requirement)" << std::endl;
+                std::cout << "DLL image is not relocatable (x86 requirement)" << '\n';
 
                 return -11;
             }
@@ -636,7 +824,7 @@ struct AssemblyEnvironment
             return findIter->second.GetSection();
         };
 
-        std::cout << "mapping sections of module into executable" << std::endl;
+        std::cout << "mapping sections of module into executable" << '\n';
 
         // Embed all sections of the DLL image into the executable image.
         // For that we have to find a place where we can allocate the "image arena".
@@ -645,36 +833,110 @@ struct AssemblyEnvironment
 
         if ( !foundNewBase )
         {
-            std::cout << "failed to find virtual address space for module image in executable image region" << std::endl;
+            std::cout << "failed to find virtual address space for module image in executable image region" << '\n';
 
             return -13;
         }
 
+        if ( ImageAddressMap *addrMap = this->addrMap )
+        {
+            addrMap->AddEntry( ImageAddressMap::eEntryType::MODULE, embedImageBaseOffset, moduleImage.peOptHeader.sizeOfImage, moduleImageName, "image arena" );
+        }
+
+        if ( StartupPageHints *startHints = this->startHints )
+        {
+            startHints->AddModule( moduleImageName, embedImageBaseOffset, moduleImage.peOptHeader.sizeOfImage );
+        }
+
+        // Rebasing and patching of the arena depend on nothing but the key, so an arena from
+        // an earlier run can be copied in directly.
+        ModuleArenaCache *moduleArenaCache = ( options.useArenaCache ? this->arenaCache : nullptr );
+
+        ModuleArenaCache::key arenaKey;
+        ModuleArenaCache::arena arenaData;
+        bool isArenaCached = false;
+
+        if ( ModuleArenaCache *arenaCache = moduleArenaCache )
+        {
+            arenaKey.moduleHash = this->moduleContentHash;
+            arenaKey.exeImageBase = exeImage.GetImageBase();
+            arenaKey.arenaRVA = embedImageBaseOffset;
+            arenaKey.optionFlags = 0;
+
+            if ( requiresRelocations )
+            {
+                arenaKey.optionFlags |= ModuleArenaCache::OPTION_RELOCATABLE;
+            }
+
+            if ( options.markAllSectionsExecutable )
+            {
+                arenaKey.optionFlags |= ModuleArenaCache::OPTION_MARK_EXECUTABLE;
+            }
+
+            if ( genCodeArch == asmjit::ArchInfo::kTypeX64 )
+            {
+                arenaKey.optionFlags |= ModuleArenaCache::OPTION_ARCH_X64;
+            }
+
+            isArenaCached = ( arenaCache->Load( arenaKey, arenaData ) && arenaData.sectionData.size() == moduleImage.GetSectionCount() );
+
+            if ( isArenaCached )
+            {
+                std::cout << "using cached module arena" << '\n';
+            }
+            else
+            {
+                arenaData = ModuleArenaCache::arena();
+            }
+        }
+
+        // Relocations of the arena are remembered for the cache.
+        auto addArenaRelocation = [&]( std::uint32_t rva, PEFile::PEBaseReloc::eRelocType relocType )
+        {
+            exeImage.AddRelocation( rva, relocType );
+
+            if ( moduleArenaCache != nullptr && !isArenaCached )
+            {
+                arenaData.relocations.push_back( { rva, (std::uint32_t)relocType } );
+            }
+        };
+
         PEFile::sectionIter_t iter = moduleImage.GetSectionIterator();
 
+        size_t modSectIndex = 0;
+
         while ( !iter.IsEnd() )
         {
             PEFile::PESection *theSect = iter.Resolve();
 
-            std::cout << "* " << theSect->shortName.GetConstString() << std::endl;
+            std::cout << "* " << theSect->shortName.GetConstString() << '\n';
 
             // Create a copy of the section.
             PEFile::PESection newSect;
             newSect.shortName = theSect->shortName;
             newSect.chars = theSect->chars;
 
-            if ( markAllSectionsExecutable )
+            if ( options.markAllSectionsExecutable )
             {
                 newSect.chars.sect_mem_execute = true;
             }
 
+            const void *sectData = theSect->stream.Data();
             size_t sectDataSize = (size_t)theSect->stream.Size();
 
+            if ( isArenaCached )
+            {
+                const std::vector <char>& cachedData = arenaData.sectionData[ modSectIndex ];
+
+                sectData = cachedData.data();
+                sectDataSize = cachedData.size();
+            }
+
             theSect->stream.Seek( 0 );
 
             newSect.stream.Seek( 0 );
             newSect.stream.Truncate( (std::int32_t)sectDataSize );
-            newSect.stream.Write( theSect->stream.Data(), sectDataSize );
+            newSect.stream.Write( sectData, sectDataSize );
 
             // Finalize ourselves.
             newSect.Finalize();
@@ -691,12 +953,19 @@ struct AssemblyEnvironment
                 throw runtime_exception( -14, "fatal: failed to allocate module section in executable image" );
             }
 
+            if ( ImageAddressMap *addrMap = this->addrMap )
+            {
+                addrMap->AddEntry( ImageAddressMap::eEntryType::SECTION, refInside->GetVirtualAddress(), refInside->GetVirtualSize(), moduleImageName, refInside->shortName.GetConstString() );
+            }
+
             PEFile::PESectionReference sectInsideRef( refInside );
 
             // Remember this link.
             sectLinkMap[ theSect ] = std::move( sectInsideRef );
 
             iter.Increment();
+
+            modSectIndex++;
         }
 
         std::uint64_t exeModuleBase = exeImage.GetImageBase();
@@ -704,7 +973,7 @@ struct AssemblyEnvironment
         // We need to create a special PESection that contains the DLL image PE headers,
         // called ".pedata".
         {
-            std::cout << "embedding module image PE headers" << std::endl;
+            std::cout << "embedding module image PE headers" << '\n';
 
             PEFile::PESection pedataSect;
             pedataSect.shortName = ".pedata";
@@ -899,7 +1168,11 @@ struct AssemblyEnvironment
 
                 if ( refInside == nullptr )
                 {
-                    std::cout << "WARNING: failed to embed module image PE headers (.pedata); module might not work properly" << std::endl;
+                    std::cout << "WARNING: failed to embed module image PE headers (.pedata); module might not work properly" << '\n';
+                }
+                else if ( ImageAddressMap *addrMap = this->addrMap )
+                {
+                    addrMap->AddEntry( ImageAddressMap::eEntryType::SECTION, refInside->GetVirtualAddress(), refInside->GetVirtualSize(), moduleImageName, refInside->shortName.GetConstString() );
                 }
             }
         }
@@ -907,20 +1180,28 @@ struct AssemblyEnvironment
         // Embed all import directories.
         if ( moduleImage.imports.GetCount() != 0 )
         {
-            std::cout << "embedding import directories" << std::endl;
+            std::cout << "embedding import directories" << '\n';
 
-            for ( const PEFile::PEImportDesc& impDesc : moduleImage.imports )
+            // Imports that the module never references do not have to be bound by the loader.
+            ImportUsageAnalysis importUsage;
+
+            if ( options.stripUnusedImports )
             {
-                // We must merge with existing descriptors because the win32 PE loader expects us to.
-                // This means that multiple import descriptors with redundant items is an absolute no-go.
-                PEFile::PEImportDesc newImports;
-                newImports.DLLName = impDesc.DLLName;
-                newImports.DLLName_allocEntry = ResolvePEAllocation( impDesc.DLLName_allocEntry, resolveSectionLink );
+                importUsage.Analyze( moduleImage, archPointerSize );
+
+                std::cout << "found " << importUsage.GetUnusedSlotCount() << " unused import entries" << '\n';
+            }
+
+            size_t numModuleImportDescs = moduleImage.imports.GetCount();
+
+            for ( size_t impDescIdx = 0; impDescIdx < numModuleImportDescs; impDescIdx++ )
+            {
+                const PEFile::PEImportDesc& impDesc = moduleImage.imports[ impDescIdx ];
 
-                std::cout << "* " << impDesc.DLLName.GetConstString() << std::endl;
+                std::cout << "* " << impDesc.DLLName.GetConstString() << '\n';
 
                 // Take over all import entries from the module.
-                newImports.funcs = PEFile::PEImportDesc::CreateEquivalentImportsList( impDesc.funcs );
+                PEFile::PEImportDesc::functions_t funcs = PEFile::PEImportDesc::CreateEquivalentImportsList( impDesc.funcs );
                 // We cannot take over the import names array because it consists of virtual addresses
                 // that we cannot patch because it is against the rules.
 
@@ -931,11 +1212,77 @@ struct AssemblyEnvironment
                 // We have to bundle all IATs in one place to do that.
                 // Solution: make the section of the IAT writable (hack!)
 
-                newImports.firstThunkRef = ResolvePEDataRedirect( impDesc.firstThunkRef, resolveSectionLink );
+                PEFile::PESectionDataReference firstThunkRef = ResolvePEDataRedirect( impDesc.firstThunkRef, resolveSectionLink );
+
+                firstThunkRef.GetSection()->chars.sect_mem_write = true;
+
+                // Unused entries split the descriptor, because the IAT slots of the used ones cannot move.
+                // A descriptor that is left without entries does not load its DLL anymore.
+                size_t numFuncs = funcs.GetCount();
+
+                auto isEntryUsed = [&]( size_t funcIdx )
+                {
+                    return ( options.stripUnusedImports == false || importUsage.IsSlotUsed( impDescIdx, funcIdx ) );
+                };
+
+                size_t runStart = 0;
+                size_t numKeptFuncs = 0;
+
+                do
+                {
+                    while ( runStart < numFuncs && isEntryUsed( runStart ) == false )
+                    {
+                        runStart++;
+                    }
+
+                    size_t runEnd = runStart;
+
+                    while ( runEnd < numFuncs && isEntryUsed( runEnd ) )
+                    {
+                        runEnd++;
+                    }
+
+                    // Descriptors without any entries are kept as they are.
+                    if ( runStart == runEnd && numFuncs != 0 )
+                        break;
+
+                    // The win32 PE loader accepts several descriptors of the same DLL, so each run of used
+                    // entries gets its own. This is safe because the runs never overlap, so no IAT slot is
+                    // bound twice, and because the writer gives every descriptor its own terminated name
+                    // array: the loader walks that array and not the IAT, which has no terminator mid-way.
+                    PEFile::PEImportDesc newImports;
+                    newImports.DLLName = impDesc.DLLName;
+                    newImports.DLLName_allocEntry = ResolvePEAllocation( impDesc.DLLName_allocEntry, resolveSectionLink );
+
+                    if ( runEnd != runStart )
+                    {
+                        newImports.funcs.InsertMove( 0, &funcs[ runStart ], runEnd - runStart );
+                    }
+
+                    newImports.firstThunkRef = PEFile::PESectionDataReference(
+                        firstThunkRef.GetSection(),
+                        firstThunkRef.GetSectionOffset() + (std::uint32_t)runStart * archPointerSize
+                    );
 
-                newImports.firstThunkRef.GetSection()->chars.sect_mem_write = true;
+                    exeImage.imports.AddToBack( std::move( newImports ) );
 
-                exeImage.imports.AddToBack( std::move( newImports ) );
+                    numKeptFuncs += ( runEnd - runStart );
+
+                    runStart = runEnd;
+                }
+                while ( runStart < numFuncs );
+
+                if ( numKeptFuncs != numFuncs )
+                {
+                    if ( numKeptFuncs == 0 )
+                    {
+                        std::cout << "* dropped unused import module " << impDesc.DLLName.GetConstString() << '\n';
+                    }
+                    else
+                    {
+                        std::cout << "* dropped " << ( numFuncs - numKeptFuncs ) << " unused entries" << '\n';
+                    }
+                }
             }
 
             // Make sure we rewrite the imports directory.
@@ -943,9 +1290,9 @@ struct AssemblyEnvironment
         }
 
         // Just for the heck of it we could embed exports aswell.
-        if ( doTakeoverExports && moduleImage.exportDir.functions.GetCount() != 0 )
+        if ( options.takeoverExports && moduleImage.exportDir.functions.GetCount() != 0 )
         {
-            std::cout << "embedding export functions" << std::endl;
+            std::cout << "embedding export functions" << '\n';
 
             // First just take over exports.
             size_t ordInputBase = exeImage.exportDir.functions.GetCount();
@@ -981,10 +1328,54 @@ struct AssemblyEnvironment
             exeImage.exportDir.funcNamesAllocEntry = PEFile::PESectionAllocation();
         }
 
+        // The address map lists all module exports, even if they are not taken over.
+        if ( ImageAddressMap *addrMap = this->addrMap )
+        {
+            const PEFile::PEExportDir& modExportDir = moduleImage.exportDir;
+
+            size_t numExportFuncs = modExportDir.functions.GetCount();
+
+            std::vector <bool> isNamedExport( numExportFuncs, false );
+
+            auto addExportToMap = [&]( size_t funcIdx, std::string name )
+            {
+                const PEFile::PEExportDir::func& expEntry = modExportDir.functions[ funcIdx ];
+
+                if ( expEntry.isForwarder || expEntry.expRef.GetSection() == nullptr )
+                {
+                    return;
+                }
+
+                std::uint32_t exportRVA = ResolvePESectionRVA( expEntry.expRef, resolveSectionLink );
+
+                addrMap->AddEntry( ImageAddressMap::eEntryType::EXPORT, exportRVA, 0, moduleImageName, std::move( name ) );
+            };
+
+            for ( auto *nameMapIter : modExportDir.funcNameMap )
+            {
+                size_t funcIdx = nameMapIter->GetValue();
+
+                if ( funcIdx < numExportFuncs )
+                {
+                    addExportToMap( funcIdx, nameMapIter->GetKey().name.GetConstString() );
+
+                    isNamedExport[ funcIdx ] = true;
+                }
+            }
+
+            for ( size_t funcIdx = 0; funcIdx < numExportFuncs; funcIdx++ )
+            {
+                if ( isNamedExport[ funcIdx ] == false )
+                {
+                    addExportToMap( funcIdx, "ordinal " + std::to_string( modExportDir.ordinalBase + funcIdx ) );
+                }
+            }
+        }
+
         // Embed delay import directories aswell.
         if ( moduleImage.delayLoads.GetCount() != 0 )
         {
-            std::cout << "embedding delay-load import directories" << std::endl;
+            std::cout << "embedding delay-load import directories" << '\n';
 
             // We do it just like for the regular imports.
             for ( const PEFile::PEDelayLoadDesc& impDesc : moduleImage.delayLoads )
@@ -1017,9 +1408,9 @@ struct AssemblyEnvironment
         // Copy over the resources aswell.
         if ( moduleImage.resourceRoot.IsEmpty() == false )
         {
-            if ( !doIgnoreResources )
+            if ( !options.ignoreResources )
             {
-                std::cout << "embedding module resources" << std::endl;
+                std::cout << "embedding module resources" << '\n';
 
                 // We merge things.
                 bool hasChanged =
@@ -1033,7 +1424,55 @@ struct AssemblyEnvironment
             }
             else
             {
-                std::cout << "ignoring resources" << std::endl;
+                std::cout << "ignoring resources" << '\n';
+            }
+        }
+
+        // Take over the debug directory entries so that debuggers and profilers can still find
+        // the symbols of the module. The CodeView records keep their original PDB path and GUID.
+        // No OMAP record is added: it would apply to the whole image and break the symbols of
+        // the executable. Addresses inside of the module are translated back to the RVAs that
+        // its PDB expects through the image arena of the address map (-map).
+        if ( moduleImage.debugDescs.GetCount() != 0 )
+        {
+            std::cout << "embedding debug directory entries" << '\n';
+
+            for ( PEFile::PEDebugDesc& modDebugDesc : moduleImage.debugDescs )
+            {
+                std::uint32_t debugType = modDebugDesc.type;
+
+                // Address maps of the module refer to its own layout.
+                if ( debugType == PEL_IMAGE_DEBUG_TYPE_OMAP_TO_SRC || debugType == PEL_IMAGE_DEBUG_TYPE_OMAP_FROM_SRC )
+                {
+                    continue;
+                }
+
+                PEFile::PEDebugDesc& newDebugDesc = exeImage.AddDebugData( debugType );
+                newDebugDesc.characteristics = modDebugDesc.characteristics;
+                newDebugDesc.timeDateStamp = modDebugDesc.timeDateStamp;
+                newDebugDesc.majorVer = modDebugDesc.majorVer;
+                newDebugDesc.minorVer = modDebugDesc.minorVer;
+
+                // Data inside of the module sections is relocated along with them.
+                if ( const PEFile::PESectionAllocation *modDataAlloc = modDebugDesc.dataStore.GetSectionData() )
+                {
+                    newDebugDesc.dataStore.SetSectionData( ResolvePEAllocation( *modDataAlloc, resolveSectionLink ) );
+                }
+                else
+                {
+                    // Data outside of the image is copied as-is.
+                    PEFile::fileSpaceStream_t modDataStream = modDebugDesc.dataStore.OpenStream();
+
+                    std::int32_t modDataSize = modDataStream.Size();
+
+                    if ( modDataSize > 0 )
+                    {
+                        PEFile::fileSpaceStream_t newDataStream = newDebugDesc.dataStore.OpenStream( true );
+
+                        newDataStream.Truncate( modDataSize );
+                        newDataStream.Write( modDataStream.Data(), (size_t)modDataSize );
+                    }
+                }
             }
         }
 
@@ -1041,109 +1480,181 @@ struct AssemblyEnvironment
 
         if ( hasStaticTLS )
         {
-            std::cout << "WARNING: module image has static TLS; might not work as expected" << std::endl;
+            std::cout << "WARNING: module image has static TLS; might not work as expected" << '\n';
         }
 
-        std::cout << "rebasing DLL sections" << std::endl;
-
-        // Relocate the module pointers properly. We have to solve two problems:
-        // 1) rebase the offsets to the new executable.
-        // 2) identify each pointer's section and redirect it into the new layout
-        for ( auto *modRelocNode : moduleImage.baseRelocs )
+        if ( isArenaCached )
         {
-            // Calculate the offset of this relocation chunk, all entries base off of it.
-            std::uint32_t relocChunkOffset = ( modRelocNode->GetKey() * PEFile::baserelocChunkSize );
-
-            const PEFile::PEBaseReloc& modRelocChunk = modRelocNode->GetValue();
+            // The cached section data is rebased already.
+            for ( const ModuleArenaCache::relocation& reloc : arenaData.relocations )
+            {
+                exeImage.AddRelocation( reloc.rva, (PEFile::PEBaseReloc::eRelocType)reloc.type );
+            }
+        }
+        else
+        {
+            std::cout << "rebasing DLL sections" << '\n';
 
-            for ( const PEFile::PEBaseReloc::item& modRelocItem : modRelocChunk.items )
+            // Relocate the module pointers properly. We have to solve two problems:
+            // 1) rebase the offsets to the new executable.
+            // 2) identify each pointer's section and redirect it into the new layout
+            for ( PEFile::PEBaseRelocStore::page modRelocPage : moduleImage.baseRelocs )
             {
-                std::uint32_t modRelocRVA = ( relocChunkOffset + modRelocItem.offset );
+                // Calculate the offset of this relocation chunk, all entries base off of it.
+                std::uint32_t relocChunkOffset = modRelocPage.GetPageRVA();
+
+                // Most pages lie inside of one section whose stored data covers all of them
+                // (including the last value, which can reach past the page end). Those pages are
+                // validated once and their items are patched without range checks.
+                const std::uint32_t pageSpan = ( PEFile::baserelocChunkSize + sizeof(std::uint64_t) );
 
-                // Find out what section this relocation points to.
-                std::uint32_t modRelocSectOffset;
-                PEFile::PESection *modRelocSect = moduleImage.FindSectionByRVA( modRelocRVA, nullptr, &modRelocSectOffset );
+                std::uint32_t pageSectOffset;
+                PEFile::PESection *pageModSect = moduleImage.FindSectionByRVA( relocChunkOffset, nullptr, &pageSectOffset );
+                PEFile::PESection *pageExeSect = nullptr;
 
-                if ( modRelocSect )
+                if ( pageModSect && moduleImage.FindSectionByRVA( relocChunkOffset + pageSpan - 1 ) == pageModSect )
                 {
-                    // Get the counter-part in the executable image.
-                    auto findIter = sectLinkMap.find( modRelocSect );
+                    auto findIter = sectLinkMap.find( pageModSect );
 
                     assert( findIter != sectLinkMap.end() );
 
-                    PEFile::PESection *exeRelocSect = findIter->second.GetSection();
+                    PEFile::PESection *exeSect = findIter->second.GetSection();
 
-                    PEFile::PEBaseReloc::eRelocType relocType = (PEFile::PEBaseReloc::eRelocType)modRelocItem.type;
-
-                    // Fix the relocation to the new image base.
-                    // For that we have to find out where the target points to and
-                    // where this translates to in our target image.
+                    if ( exeSect->HasDataRange( pageSectOffset, pageSpan ) )
                     {
-                        if ( relocType == PEFile::PEBaseReloc::eRelocType::HIGHLOW )
-                        {
-                            std::uint32_t origValue = 0;
-
-                            exeRelocSect->stream.Seek( modRelocSectOffset );
-                            exeRelocSect->stream.ReadUInt32( origValue );
-
-                            std::uint32_t rvaTarget = ( origValue - (std::uint32_t)modImageBase );
-                            std::uint32_t newTargetRVA = ( embedImageBaseOffset + rvaTarget );
+                        pageExeSect = exeSect;
+                    }
+                }
 
-                            exeRelocSect->stream.Seek( modRelocSectOffset );
-                            exeRelocSect->stream.WriteUInt32( newTargetRVA + (std::uint32_t)exeModuleBase );
-                        }
-                        else if ( relocType == PEFile::PEBaseReloc::eRelocType::DIR64 )
-                        {
-                            std::uint64_t origValue = 0;
+                for ( const PEFile::PEBaseReloc::item& modRelocItem : modRelocPage )
+                {
+                    std::uint32_t modRelocRVA = ( relocChunkOffset + modRelocItem.offset );
 
-                            exeRelocSect->stream.Seek( modRelocSectOffset );
-                            exeRelocSect->stream.ReadUInt64( origValue );
+                    // Find out what section this relocation points to.
+                    std::uint32_t modRelocSectOffset;
+                    PEFile::PESection *modRelocSect;
+                    PEFile::PESection *exeRelocSect = nullptr;
 
-                            std::uint32_t rvaTarget = (std::uint32_t)( origValue - modImageBase );
-                            std::uint32_t newTargetRVA = ( embedImageBaseOffset + rvaTarget );
+                    if ( pageExeSect != nullptr )
+                    {
+                        modRelocSect = pageModSect;
+                        modRelocSectOffset = ( pageSectOffset + modRelocItem.offset );
+                        exeRelocSect = pageExeSect;
+                    }
+                    else
+                    {
+                        modRelocSect = moduleImage.FindSectionByRVA( modRelocRVA, nullptr, &modRelocSectOffset );
 
-                            exeRelocSect->stream.Seek( modRelocSectOffset );
-                            exeRelocSect->stream.WriteUInt64( newTargetRVA + exeModuleBase );
-                        }
-                        else if ( relocType == PEFile::PEBaseReloc::eRelocType::ABSOLUTE )
-                        {
-                            // Gotta ignore.
-                        }
-                        else
+                        if ( modRelocSect )
                         {
-                            std::cout << "unknown relocation type in PE rebasing procedure" << std::endl;
+                            // Get the counter-part in the executable image.
+                            auto findIter = sectLinkMap.find( modRelocSect );
 
-                            return -15;
+                            assert( findIter != sectLinkMap.end() );
+
+                            exeRelocSect = findIter->second.GetSection();
                         }
                     }
 
-                    if ( requiresRelocations )
+                    if ( modRelocSect )
                     {
-                        // Register this new rebasing.
-                        exeImage.AddRelocation( embedImageBaseOffset + modRelocRVA, relocType );
-                    }
-                }
-            }
-        }
 
-        // We might want to inject exports into the imports of the executable module.
-        if ( injectMatchingImports )
-        {
-            std::cout << "injecting matched PE imports..." << std::endl;
+                        PEFile::PEBaseReloc::eRelocType relocType = (PEFile::PEBaseReloc::eRelocType)modRelocItem.type;
 
-            // Should keep track of how many items we matched of which type.
-            size_t numOrdinalMatches = 0;
-            size_t numNameMatches = 0;
+                        // Fix the relocation to the new image base.
+                        // For that we have to find out where the target points to and
+                        // where this translates to in our target image.
+                        {
+                            if ( relocType == PEFile::PEBaseReloc::eRelocType::HIGHLOW )
+                            {
+                                std::uint32_t origValue = 0;
 
-            // For each export entry in our importing module we check for all import entries
-            // that match it in the executable module. If we find a match we split the import
-            // directories in the thunk so that we can write into the loader address during
-            // entry point.
-            {
-                size_t dstImpDescIter = 0;
-                size_t numImportDescs = exeImage.imports.GetCount();
+                                if ( pageExeSect != nullptr )
+                                {
+                                    origValue = exeRelocSect->ReadValueUnchecked <std::uint32_t> ( modRelocSectOffset );
+                                }
+                                else
+                                {
+                                    ReadSectionValue( exeRelocSect, modRelocSectOffset, origValue );
+                                }
 
-                while ( dstImpDescIter < numImportDescs )
+                                std::uint32_t rvaTarget = ( origValue - (std::uint32_t)modImageBase );
+                                std::uint32_t newTargetRVA = ( embedImageBaseOffset + rvaTarget );
+
+                                if ( pageExeSect != nullptr )
+                                {
+                                    exeRelocSect->WriteValueUnchecked <std::uint32_t> ( modRelocSectOffset, newTargetRVA + (std::uint32_t)exeModuleBase );
+                                }
+                                else
+                                {
+                                    WriteSectionValue( exeRelocSect, modRelocSectOffset, newTargetRVA + (std::uint32_t)exeModuleBase );
+                                }
+                            }
+                            else if ( relocType == PEFile::PEBaseReloc::eRelocType::DIR64 )
+                            {
+                                std::uint64_t origValue = 0;
+
+                                if ( pageExeSect != nullptr )
+                                {
+                                    origValue = exeRelocSect->ReadValueUnchecked <std::uint64_t> ( modRelocSectOffset );
+                                }
+                                else
+                                {
+                                    ReadSectionValue( exeRelocSect, modRelocSectOffset, origValue );
+                                }
+
+                                std::uint32_t rvaTarget = (std::uint32_t)( origValue - modImageBase );
+                                std::uint32_t newTargetRVA = ( embedImageBaseOffset + rvaTarget );
+
+                                if ( pageExeSect != nullptr )
+                                {
+                                    exeRelocSect->WriteValueUnchecked <std::uint64_t> ( modRelocSectOffset, newTargetRVA + exeModuleBase );
+                                }
+                                else
+                                {
+                                    WriteSectionValue( exeRelocSect, modRelocSectOffset, newTargetRVA + exeModuleBase );
+                                }
+                            }
+                            else if ( relocType == PEFile::PEBaseReloc::eRelocType::ABSOLUTE )
+                            {
+                                // Gotta ignore.
+                            }
+                            else
+                            {
+                                std::cout << "unknown relocation type in PE rebasing procedure" << '\n';
+
+                                return -15;
+                            }
+                        }
+
+                        if ( requiresRelocations )
+                        {
+                            // Register this new rebasing.
+                            addArenaRelocation( embedImageBaseOffset + modRelocRVA, relocType );
+                        }
+                    }
+                }
+            }
+        }
+
+        // We might want to inject exports into the imports of the executable module.
+        if ( options.injectMatchingImports )
+        {
+            std::cout << "injecting matched PE imports..." << '\n';
+
+            // Should keep track of how many items we matched of which type.
+            size_t numOrdinalMatches = 0;
+            size_t numNameMatches = 0;
+
+            // For each export entry in our importing module we check for all import entries
+            // that match it in the executable module. If we find a match we split the import
+            // directories in the thunk so that we can write into the loader address during
+            // entry point.
+            {
+                size_t dstImpDescIter = 0;
+                size_t numImportDescs = exeImage.imports.GetCount();
+
+                while ( dstImpDescIter < numImportDescs )
                 {
                     PEFile::PEImportDesc& impDesc = exeImage.imports[ dstImpDescIter ];
 
@@ -1231,7 +1742,7 @@ struct AssemblyEnvironment
 
                     if ( removeImpDesc )
                     {
-                        std::cout << "* terminated import module " << impDesc.DLLName.GetConstString() << std::endl;
+                        std::cout << "* terminated import module " << impDesc.DLLName.GetConstString() << '\n';
 
                         exeImage.imports.RemoveByIndex( dstImpDescIter );
 
@@ -1360,7 +1871,7 @@ struct AssemblyEnvironment
 
                     if ( removeImpDesc )
                     {
-                        std::cout << "* terminated delay-load import module " << impDesc.DLLName.GetConstString() << std::endl;
+                        std::cout << "* terminated delay-load import module " << impDesc.DLLName.GetConstString() << '\n';
 
                         exeImage.delayLoads.RemoveByIndex( dstImpDescIter );
 
@@ -1380,15 +1891,16 @@ struct AssemblyEnvironment
             }
 
             // Output some helpful statistics.
-            std::cout << "injected " << numNameMatches << " named and " << numOrdinalMatches << " ordinal PE imports" << std::endl;
+            std::cout << "injected " << numNameMatches << " named and " << numOrdinalMatches << " ordinal PE imports" << '\n';
         }
 
         // TODO: generate all code that depends on RVAs over here.
 
         // Do we need TLS data?
-        if ( moduleImage.tlsInfo.startOfRawDataRef.GetSection() != nullptr )
+        // A cached arena has been patched already.
+        if ( !isArenaCached && moduleImage.tlsInfo.startOfRawDataRef.GetSection() != nullptr )
         {
-            std::cout << "patching static TLS data references" << std::endl;
+            std::cout << "patching static TLS data references" << '\n';
 
             // Calculate the VA to the TLS.
             std::uint64_t vaTLSData;
@@ -1402,6 +1914,9 @@ struct AssemblyEnvironment
 
             // We do a simple patch of all TLS references to point directly inside the TLS data array.
             // This will disable all thread-local abilities but it will make the embedding work.
+            PEFile::PERelocTargetIndex modRelocIndex;
+            modRelocIndex.Build( moduleImage );
+
             PEFile::sectionIter_t iter = moduleImage.GetSectionIterator();
 
             for ( ; !iter.IsEnd(); iter.Increment() )
@@ -1434,10 +1949,39 @@ struct AssemblyEnvironment
                     };
 
                     char *dataBuf = (char*)exeSect->stream.Data();
+                    size_t dataSize = (size_t)exeSect->stream.Size();
+
+                    // Matches inside of instructions that were decoded in sync are not patched.
+                    // Everything else is, since a TLS access that is left alone crashes at runtime.
+                    InstructionStartIndex insnIndex;
+                    {
+                        std::vector <std::uint32_t> seedOffsets;
+
+                        CollectInstructionSeeds( moduleImage, modRelocIndex, modSect, seedOffsets );
 
-                    BufferPatternFind( dataBuf, (size_t)exeSect->stream.Size(), countof(patterns), patterns,
+                        insnIndex.Build( dataBuf, dataSize, false, std::move( seedOffsets ) );
+                    }
+
+                    size_t numSkippedMatches = 0;
+                    size_t numUnconfirmedMatches = 0;
+
+                    BufferPatternFind( dataBuf, dataSize, countof(patterns), patterns,
                         [&]( size_t patIdx, size_t bufOff, size_t matchSize )
                     {
+                        if ( insnIndex.IsInsideSyncedInstruction( bufOff ) )
+                        {
+                            std::cout << "warning: not patching TLS pattern match inside of another instruction at RVA 0x" << std::hex << exeSect->ResolveRVA( (std::uint32_t)bufOff ) << std::dec << '\n';
+
+                            numSkippedMatches++;
+                            return;
+                        }
+
+                        // Matches in bytes that did not decode as code might be data that looks like the pattern.
+                        if ( insnIndex.IsInstructionStart( bufOff ) == false )
+                        {
+                            numUnconfirmedMatches++;
+                        }
+
                         // Just need to put a NOP.
                         // Then patch the offset with a new one.
                         char *curPtr = ( dataBuf + bufOff );
@@ -1452,12 +1996,22 @@ struct AssemblyEnvironment
                         // If the image is relocatable, add a relocation entry aswell.
                         if ( requiresRelocations )
                         {
-                            exeImage.AddRelocation( exeSect->ResolveRVA( (std::uint32_t)( bufOff + 2 ) ), PEFile::PEBaseReloc::eRelocType::HIGHLOW );
+                            addArenaRelocation( exeSect->ResolveRVA( (std::uint32_t)( bufOff + 2 ) ), PEFile::PEBaseReloc::eRelocType::HIGHLOW );
                         }
 
                         // Pad the remainder with NOPs.
                         memset( curPtr + 6, 0x90, matchSize - 6 );
                     });
+
+                    if ( numSkippedMatches > 0 )
+                    {
+                        std::cout << "warning: skipped " << numSkippedMatches << " TLS pattern matches; check the addresses above if the module crashes on TLS access" << '\n';
+                    }
+
+                    if ( numUnconfirmedMatches > 0 )
+                    {
+                        std::cout << "note: patched " << numUnconfirmedMatches << " TLS pattern matches that were not decoded as instruction starts" << '\n';
+                    }
                 }
                 else if ( genCodeArch == asmjit::ArchInfo::kTypeX64 )
                 {
@@ -1470,6 +2024,32 @@ struct AssemblyEnvironment
             }
         }
 
+        // The arena is complete now, so it can be reused by later runs.
+        if ( ModuleArenaCache *arenaCache = moduleArenaCache )
+        {
+            if ( !isArenaCached )
+            {
+                PEFile::sectionIter_t iter = moduleImage.GetSectionIterator();
+
+                for ( ; !iter.IsEnd(); iter.Increment() )
+                {
+                    PEFile::PESection *exeSect = resolveSectionLink( iter.Resolve() );
+
+                    const char *sectData = (const char*)exeSect->stream.Data();
+
+                    arenaData.sectionData.emplace_back( sectData, sectData + exeSect->stream.Size() );
+                }
+
+                if ( !arenaCache->Store( arenaKey, arenaData ) )
+                {
+                    std::cout << "warning: failed to store module arena in cache" << '\n';
+                }
+            }
+        }
+
+        // Module initialization starts here.
+        this->EmitStubProfileTimestamp( offsetof(stubProfileEntry, tscInitBegin) );
+
         // So if we have TLS indices, we have to use the utility thunk to allocate into the array.
         if ( hasStaticTLS )
         {
@@ -1494,29 +2074,47 @@ struct AssemblyEnvironment
         // Call all initializers if we have some.
         if ( PEFile::PESection *tlsSect = moduleImage.tlsInfo.addressOfCallbacksRef.GetSection() )
         {
-            std::cout << "linking TLS callbacks" << std::endl;
+            std::cout << "linking TLS callbacks" << '\n';
 
             std::uint32_t indexOfCallback = 0;
 
             std::uint32_t sectoffAddrOfCallbacks = moduleImage.tlsInfo.addressOfCallbacksRef.GetSectionOffset();
 
+            // The slots that lie inside of the stored section data are read without range checks.
+            std::uint32_t numStoredCallbacks = 0;
+
+            if ( tlsSect->HasDataRange( sectoffAddrOfCallbacks, 0 ) && archPointerSize != 0 )
+            {
+                numStoredCallbacks = ( ( (std::uint32_t)tlsSect->stream.Size() - sectoffAddrOfCallbacks ) / archPointerSize );
+            }
+
             while ( true )
             {
                 std::uint64_t callbackPtr;
 
-                tlsSect->stream.Seek( (std::int32_t)( sectoffAddrOfCallbacks + indexOfCallback * archPointerSize ) );
+                std::uint32_t sectoffCallback = ( sectoffAddrOfCallbacks + indexOfCallback * archPointerSize );
+
+                bool isStoredCallback = ( indexOfCallback < numStoredCallbacks );
 
                 // Advance the index to next.
                 indexOfCallback++;
 
-                if ( archPointerSize == 4 )
+                if ( archPointerSize == 4 && isStoredCallback )
+                {
+                    callbackPtr = tlsSect->ReadValueUnchecked <std::uint32_t> ( sectoffCallback );
+                }
+                else if ( archPointerSize == 8 && isStoredCallback )
+                {
+                    callbackPtr = tlsSect->ReadValueUnchecked <std::uint64_t> ( sectoffCallback );
+                }
+                else if ( archPointerSize == 4 )
                 {
                     std::uint32_t value;
-                    bool gotValue = tlsSect->stream.ReadUInt32( value );
+                    bool gotValue = ReadSectionValue( tlsSect, sectoffCallback, value );
 
                     if ( !gotValue )
                     {
-                        std::cout << "failed to read 32bit TLS callback value" << std::endl;
+                        std::cout << "failed to read 32bit TLS callback value" << '\n';
 
                         return -16;
                     }
@@ -1525,18 +2123,18 @@ struct AssemblyEnvironment
                 }
                 else if ( archPointerSize == 8 )
                 {
-                    bool gotValue = tlsSect->stream.ReadUInt64( callbackPtr );
+                    bool gotValue = ReadSectionValue( tlsSect, sectoffCallback, callbackPtr );
 
                     if ( !gotValue )
                     {
-                        std::cout << "failed to read 64bit TLS callback value" << std::endl;
+                        std::cout << "failed to read 64bit TLS callback value" << '\n';
 
                         return -16;
                     }
                 }
                 else
                 {
-                    std::cout << "invalid architecture pointer size" << std::endl;
+                    std::cout << "invalid architecture pointer size" << '\n';
 
                     return -16;
                 }
@@ -1567,6 +2165,16 @@ struct AssemblyEnvironment
 
                 if ( rvaToCallback != 0 )
                 {
+                    if ( ImageAddressMap *addrMap = this->addrMap )
+                    {
+                        addrMap->AddEntry( ImageAddressMap::eEntryType::INIT, rvaToCallback, 0, moduleImageName, "TLS callback " + std::to_string( indexOfCallback - 1 ) );
+                    }
+
+                    if ( StartupPageHints *startHints = this->startHints )
+                    {
+                        startHints->AddRange( rvaToCallback, 1 );
+                    }
+
                     // Call this function.
                     std::uint32_t paramReserved = 0;
                     std::uint32_t paramReason = 1;  // DLL_PROCESS_ATTACH
@@ -1587,7 +2195,7 @@ struct AssemblyEnvironment
                     }
                     else
                     {
-                        std::cout << "failed to call TLS callback due to unknown architecture" << std::endl;
+                        std::cout << "failed to call TLS callback due to unknown architecture" << '\n';
 
                         return -17;
                     }
@@ -1595,6 +2203,8 @@ struct AssemblyEnvironment
             }
         }
 
+        this->EmitStubProfileTimestamp( offsetof(stubProfileEntry, tscTLSEnd) );
+
         // Check if we even have an entry point.
         // If we have no entry point then we do not embed a call to it.
         const PEFile::PESectionDataReference& modEntryPointRef = moduleImage.peOptHeader.addressOfEntryPointRef;
@@ -1605,6 +2215,17 @@ struct AssemblyEnvironment
 
             // Call into the DLL entry point with the default parameters.
             std::uint32_t rvaToDLLEntryPoint = ResolvePESectionRVA( modEntryPointRef, resolveSectionLink, &targetModEntryPointSect );
+
+            if ( ImageAddressMap *addrMap = this->addrMap )
+            {
+                addrMap->AddEntry( ImageAddressMap::eEntryType::INIT, rvaToDLLEntryPoint, 0, moduleImageName, "DLL entry point" );
+            }
+
+            if ( StartupPageHints *startHints = this->startHints )
+            {
+                startHints->AddRange( rvaToDLLEntryPoint, 1 );
+            }
+
             {
                 std::uint32_t paramReserved = 0;
                 std::uint32_t paramReason = 1;      // DLL_PROCESS_ATTACH
@@ -1626,18 +2247,18 @@ struct AssemblyEnvironment
                 }
                 else
                 {
-                    std::cout << "unknown target machine architecture for entry point generation" << std::endl;
+                    std::cout << "unknown target machine architecture for entry point generation" << '\n';
 
                     return -12;
                 }
 
                 // If the section of the entry point is not marked executable, then we probably want to fix this here.
                 // This is a strange thing inside of the Win32 PE loader.
-                if ( doFixEntrypointExecutable )
+                if ( options.fixEntrypointExecutable )
                 {
                     if ( targetModEntryPointSect->chars.sect_mem_execute == false )
                     {
-                        std::cout << "fixing module entry point section to executable" << std::endl;
+                        std::cout << "fixing module entry point section to executable" << '\n';
 
                         targetModEntryPointSect->chars.sect_mem_execute = true;
                     }
@@ -1646,14 +2267,19 @@ struct AssemblyEnvironment
         }
         else
         {
-            std::cout << "no DLL entry point (skip)" << std::endl;
+            std::cout << "no DLL entry point (skip)" << '\n';
         }
 
+        this->EmitStubProfileTimestamp( offsetof(stubProfileEntry, tscInitEnd) );
+
         // Success!
         return 0;
     }
 };
 
+// Amount of archive members that are decompressed at the same time.
+static const unsigned int MAX_ARCHIVE_PREFETCH_COUNT = 4;
+
 // Fetches a filename from a file path, or at least attempts to.
 static const char* FetchFileName( const char *path )
 {
@@ -1681,25 +2307,108 @@ static const char* FetchFileName( const char *path )
     return last_file_name;
 }
 
-int main( int argc, char *argv[] )
+// Prints the memory statistics of peframework per allocation tag.
+static void PrintMemoryStats( const char *phaseName )
 {
-    std::cout <<
-        "dll2exe - Inject DLL or ASI file into EXE file, compiled on " __DATE__ << std::endl
-     << "Source code and builds available on https://github.com/bads-tm-lab/dll2exe" << std::endl
-	 << "\nBased on http://pefrm-units.osdn.jp/pefrmdllembed.html" << std::endl << std::endl;
+    char lineBuf[ 128 ];
+
+    std::cout << "memory after " << phaseName << ":" << '\n';
+
+    snprintf( lineBuf, sizeof(lineBuf), "  %-10s %12s %9s %12s %12s %9s", "tag", "live bytes", "live", "phase peak", "peak", "allocs" );
+    std::cout << lineBuf << '\n';
+
+    for ( size_t n = 0; n < (size_t)ePEMemoryTag::COUNT; n++ )
+    {
+        ePEMemoryTag tag = (ePEMemoryTag)n;
+
+        PEMemoryTagStats stats = PEMemoryTracker::GetStats( tag );
+
+        snprintf( lineBuf, sizeof(lineBuf), "  %-10s %12llu %9llu %12llu %12llu %9llu",
+            PEMemoryTracker::GetTagName( tag ),
+            (unsigned long long)stats.liveBytes, (unsigned long long)stats.liveCount,
+            (unsigned long long)stats.phasePeakBytes, (unsigned long long)stats.peakBytes, (unsigned long long)stats.totalCount
+        );
+        std::cout << lineBuf << '\n';
+    }
+}
+
+// Names of the return codes for the event stream, so that tools do not have to know the numbers.
+struct runResultName
+{
+    int code;
+    const char *name;
+};
+
+static const runResultName runResultNames[] =
+{
+    { 0, "ok" },
+    { -1, "exe_load_failed" },
+    { -2, "module_load_failed" },
+    { -3, "machine_mismatch" },
+    { -4, "unsupported_machine" },
+    { -5, "exe_not_executable" },
+    { -6, "module_not_dll" },
+    { -7, "invalid_machine" },
+    { -10, "code_link_failed" },
+    { -11, "module_not_relocatable" },
+    { -12, "unknown_entry_arch" },
+    { -13, "no_virtual_space" },
+    { -14, "section_alloc_failed" },
+    { -15, "unknown_reloc_type" },
+    { -16, "tls_callback_read_failed" },
+    { -17, "tls_callback_unknown_arch" },
+    { -18, "output_create_failed" },
+    { -19, "ref_to_unembedded_section" },
+    { -20, "unbound_rva" },
+    { -21, "map_write_failed" },
+    { -22, "profile_alloc_failed" },
+    { -23, "codegen_init_failed" },
+    { -24, "mmap_finalize_failed" },
+    { -25, "initrvas_read_failed" },
+    { -26, "starthints_write_failed" },
+    { -27, "archive_read_failed" },
+    { -28, "archive_no_match" },
+    { -29, "manifest_invalid" },
+    { -30, "no_modules" },
+    { -31, "events_open_failed" },
+    { -32, "initrvas_without_starthints" },
+    { -42, "peframework_error" }
+};
+
+static const char* GetRunResultName( int code )
+{
+    for ( const runResultName& result : runResultNames )
+    {
+        if ( result.code == code )
+        {
+            return result.name;
+        }
+    }
 
+    return "error";
+}
+
+static int RunEmbedding( int argc, char *argv[], EventLog& events )
+{
 	// dll2exe.exe app.exe patch1.asi patch2.asi app_patched.exe
     // Syntax: pefrmdllembed.exe *OPTIONS* *input exe filename* *input mod1 filename* *input mod2 filename* ... *input modn filename* *output exe filename*
 
     size_t curArg = 1;
 
     bool doFixEntryPoint = false;
-    bool doInjectMatchingImports = false;
-    bool doTakeoverExports = true;
-    bool doFixEntrypointExecutable = true;
-    bool markAllSectionsExecutable = false;
+    ModuleEmbedOptions defaultModuleOptions;
+    const char *manifestFileName = nullptr;
     bool doPrintHelp = false;
-    bool doIgnoreResources = false;
+    const char *mapFileName = nullptr;
+    bool doStubProfile = false;
+    bool doMappedOutput = false;
+    bool doMemoryStats = false;
+    const char *arenaCacheDir = nullptr;
+    const char *startHintsFileName = nullptr;
+    const char *initRVAListFileName = nullptr;
+    const char *eventsTarget = nullptr;
+    const char *jobId = nullptr;
+    bool doQuiet = false;
 
     if ( argc >= 1 )
     {
@@ -1717,33 +2426,96 @@ int main( int argc, char *argv[] )
             {
                 doFixEntryPoint = true;
             }
-            else if ( opt == "injimp" || opt == "impinj" )
+            else if ( ApplyModuleOption( opt, defaultModuleOptions ) )
             {
-                doInjectMatchingImports = true;
-            }
-            else if ( opt == "noexp" )
-            {
-                doTakeoverExports = false;
+                // Applies to every module, unless the manifest says otherwise.
             }
             else if ( opt == "help" || opt == "h" || opt == "?" )
             {
                 doPrintHelp = true;
             }
-            else if ( opt == "nores" || opt == "ignres" )
+            else if ( opt == "manifest" )
+            {
+                manifestFileName = optParser.FetchValue();
+
+                if ( manifestFileName == nullptr )
+                {
+                    std::cout << "missing file name for cmdline option: " << opt << '\n';
+                }
+            }
+            else if ( opt == "stubprofile" )
+            {
+                doStubProfile = true;
+            }
+            else if ( opt == "mmapout" )
             {
-                doIgnoreResources = true;
+                doMappedOutput = true;
             }
-            else if ( opt == "noentryexecfix" || opt == "noeexecfix" )
+            else if ( opt == "memstats" )
             {
-                doFixEntrypointExecutable = false;
+                doMemoryStats = true;
             }
-            else if ( opt == "marksectexec" )
+            else if ( opt == "starthints" )
             {
-                markAllSectionsExecutable = true;
+                startHintsFileName = optParser.FetchValue();
+
+                if ( startHintsFileName == nullptr )
+                {
+                    std::cout << "missing file name for cmdline option: " << opt << '\n';
+                }
+            }
+            else if ( opt == "initrvas" )
+            {
+                initRVAListFileName = optParser.FetchValue();
+
+                if ( initRVAListFileName == nullptr )
+                {
+                    std::cout << "missing file name for cmdline option: " << opt << '\n';
+                }
+            }
+            else if ( opt == "arenacache" )
+            {
+                arenaCacheDir = optParser.FetchValue();
+
+                if ( arenaCacheDir == nullptr )
+                {
+                    std::cout << "missing directory for cmdline option: " << opt << '\n';
+                }
+            }
+            else if ( opt == "events" )
+            {
+                eventsTarget = optParser.FetchValue();
+
+                if ( eventsTarget == nullptr )
+                {
+                    std::cout << "missing descriptor or file name for cmdline option: " << opt << '\n';
+                }
+            }
+            else if ( opt == "jobid" )
+            {
+                jobId = optParser.FetchValue();
+
+                if ( jobId == nullptr )
+                {
+                    std::cout << "missing id for cmdline option: " << opt << '\n';
+                }
+            }
+            else if ( opt == "quiet" )
+            {
+                doQuiet = true;
+            }
+            else if ( opt == "map" )
+            {
+                mapFileName = optParser.FetchValue();
+
+                if ( mapFileName == nullptr )
+                {
+                    std::cout << "missing file name for cmdline option: " << opt << '\n';
+                }
             }
             else
             {
-                std::cout << "unknown cmdline option: " << opt << std::endl;
+                std::cout << "unknown cmdline option: " << opt << '\n';
             }
         }
 
@@ -1754,20 +2526,47 @@ int main( int argc, char *argv[] )
         argc -= (int)optArgIndex;
     }
 
+    // The text output is only for people; with -quiet the event stream is all there is.
+    if ( doQuiet )
+    {
+        std::cout.rdbuf( nullptr );
+        std::wcout.rdbuf( nullptr );
+    }
+
+    std::cout <<
+        "dll2exe - Inject DLL or ASI file into EXE file, compiled on " __DATE__ << '\n'
+     << "Source code and builds available on https://github.com/bads-tm-lab/dll2exe" << '\n'
+	 << "\nBased on http://pefrm-units.osdn.jp/pefrmdllembed.html" << "\n\n";
+
     // If we print help, then we just do that and quit.
     if ( doPrintHelp )
     {
-        std::cout << "USAGE: -[options] *input.exe* *input1.dll* *input2.dll* ... *inputn.dll* *output.exe*" << std::endl;
-        std::cout << std::endl;
-
-        std::cout << "Option Descriptions:" << std::endl;
-        std::cout << "-efix: restores original executable entry point in PE header after DLL load" << std::endl;
-        std::cout << "-injimp: hooks executable imports with input DLL exports" << std::endl;
-        std::cout << "-noexp: does not take over DLL exports into executable" << std::endl;
-        std::cout << "-nores: leaves out resources from the DLL" << std::endl;
-        std::cout << "-noentryexecfix: prevents making sections of entry points executable if not already" << std::endl;
-        std::cout << "-marksectexec: marks all injected sections executable" << std::endl;
-        std::cout << "-help: prints this help text" << std::endl;
+        std::cout << "USAGE: -[options] *input.exe* *input1.dll* *input2.dll* ... *inputn.dll* *output.exe*" << '\n';
+        std::cout << "   or: -[options] -manifest *modules.txt* *input.exe* *output.exe*" << '\n';
+        std::cout << "modules can also be read from zip or tar archives as *archive.zip*:*path* (wildcards: * and ?)" << '\n';
+        std::cout << '\n';
+
+        std::cout << "Option Descriptions:" << '\n';
+        std::cout << "-efix: restores original executable entry point in PE header after DLL load" << '\n';
+        std::cout << "-injimp: hooks executable imports with input DLL exports" << '\n';
+        std::cout << "-noexp: does not take over DLL exports into executable" << '\n';
+        std::cout << "-nores: leaves out resources from the DLL" << '\n';
+        std::cout << "-noentryexecfix: prevents making sections of entry points executable if not already" << '\n';
+        std::cout << "-marksectexec: marks all injected sections executable" << '\n';
+        std::cout << "-stripimp: leaves out DLL imports that the DLL itself never references" << '\n';
+        std::cout << "-manifest *file*: embeds the modules listed in a file, one per line with its own options (\"module.asi -nores -stripimp\")" << '\n';
+        std::cout << "   -noimpinj, -exp, -res, -entryexecfix, -nomarksectexec, -nostripimp and -noarenacache undo options for a module" << '\n';
+        std::cout << "-stubprofile: records startup time of each module initializer into an exported table" << '\n';
+        std::cout << "-map *file*: writes an address map of the output image (modules, sections, exports, stub code)" << '\n';
+        std::cout << "-mmapout: writes the output image through a memory-mapped file, copying section data on multiple threads" << '\n';
+        std::cout << "-memstats: prints live and peak memory per subsystem after each processing phase" << '\n';
+        std::cout << "-arenacache *dir*: reuses relocated module images from earlier runs that are stored in a directory" << '\n';
+        std::cout << "-starthints *file*: writes the pages touched during startup as prefetch ranges, along with cold sections" << '\n';
+        std::cout << "-initrvas *file*: adds init-time RVAs (\"rva\" or \"module rva\" per line) to the startup hints, needs -starthints" << '\n';
+        std::cout << "-events *fd|file*: writes progress, counters and errors as NDJSON events to a file descriptor or file" << '\n';
+        std::cout << "-jobid *id*: names the run in the events (default: output file name)" << '\n';
+        std::cout << "-quiet: prints no text output" << '\n';
+        std::cout << "-help: prints this help text" << '\n';
 
         return 0;
     }
@@ -1781,16 +2580,21 @@ int main( int argc, char *argv[] )
     }
 
     // Calculate the amount of module images to embed.
+    // With a manifest, modules on the command line are optional.
     unsigned int numberModules = 1;
 
-    if ( argc >= 5 )
+    if ( manifestFileName != nullptr )
+    {
+        numberModules = (unsigned int)( argc >= 3 ? argc - 3 : 0 );
+    }
+    else if ( argc >= 5 )
     {
         numberModules = (unsigned int)( argc - 3 );
     }
 
     std::vector <const char*> toEmbedList;
 
-    if ( argc >= 3 )
+    if ( argc >= 3 || manifestFileName != nullptr )
     {
         toEmbedList.reserve( numberModules );
 
@@ -1808,11 +2612,146 @@ int main( int argc, char *argv[] )
 
     const char *outputModImageName = "output.exe";
 
-    if ( argc >= 4 )
+    if ( argc >= 4 || ( manifestFileName != nullptr && argc >= 3 ) )
     {
         outputModImageName = argv[curArg++];
     }
 
+    if ( eventsTarget != nullptr )
+    {
+        events.SetJobId( jobId != nullptr ? jobId : outputModImageName );
+
+        if ( !events.Open( eventsTarget ) )
+        {
+            std::cout << "failed to open event stream (" << eventsTarget << ")" << '\n';
+
+            return -31;
+        }
+    }
+
+    // The init-time RVAs are only used for the startup hints.
+    if ( initRVAListFileName != nullptr && startHintsFileName == nullptr )
+    {
+        std::cout << "-initrvas needs -starthints" << '\n';
+
+        return -32;
+    }
+
+    // Options of each module to embed (parallel to toEmbedList).
+    std::vector <ModuleEmbedOptions> moduleOptions( toEmbedList.size(), defaultModuleOptions );
+
+    // Modules of the manifest come after the ones on the command line.
+    ModuleManifest moduleManifest;
+
+    if ( manifestFileName != nullptr )
+    {
+        if ( !moduleManifest.Load( manifestFileName, defaultModuleOptions ) )
+        {
+            if ( moduleManifest.errorLine == 0 )
+            {
+                std::cout << "failed to read module manifest (" << manifestFileName << ")" << '\n';
+            }
+            else
+            {
+                std::cout << "invalid line " << moduleManifest.errorLine << " in module manifest (" << manifestFileName << ")" << '\n';
+            }
+
+            return -29;
+        }
+
+        for ( const ModuleManifest::entry& item : moduleManifest.entries )
+        {
+            toEmbedList.push_back( item.path.c_str() );
+            moduleOptions.push_back( item.options );
+        }
+
+        if ( toEmbedList.empty() )
+        {
+            std::cout << "no modules to embed" << '\n';
+
+            return -30;
+        }
+    }
+
+    // Modules can be read from inside of zip or tar archives ("mods.zip:scripts/*.asi").
+    // Each archive argument is replaced by the members that it matches.
+    struct archiveModuleSource
+    {
+        std::shared_ptr <const ModuleArchive> archive;      // nullptr for module files
+        size_t memberIdx = 0;
+        unsigned int argEndIdx = 0;                         // end of the modules of the same argument
+    };
+
+    std::list <std::string> archiveModuleNames;
+    std::vector <archiveModuleSource> moduleArchiveSources;
+    {
+        std::unordered_map <std::string, std::shared_ptr <ModuleArchive>> openArchives;
+
+        std::vector <const char*> expandedEmbedList;
+        std::vector <ModuleEmbedOptions> expandedModuleOptions;
+
+        for ( size_t argIdx = 0; argIdx < toEmbedList.size(); argIdx++ )
+        {
+            const char *inputModImageName = toEmbedList[ argIdx ];
+
+            std::string archivePath, memberPattern;
+
+            if ( !SplitArchiveModulePath( inputModImageName, archivePath, memberPattern ) )
+            {
+                expandedEmbedList.push_back( inputModImageName );
+                expandedModuleOptions.push_back( moduleOptions[ argIdx ] );
+                moduleArchiveSources.emplace_back();
+                continue;
+            }
+
+            std::shared_ptr <ModuleArchive>& archive = openArchives[ archivePath ];
+
+            if ( !archive )
+            {
+                archive = std::make_shared <ModuleArchive> ();
+
+                if ( !archive->Open( archivePath.c_str() ) )
+                {
+                    std::cout << "failed to read module archive (" << archivePath << ")" << '\n';
+
+                    return -27;
+                }
+            }
+
+            std::vector <size_t> foundMembers;
+            archive->FindMembers( memberPattern.c_str(), foundMembers );
+
+            if ( foundMembers.empty() )
+            {
+                std::cout << "no module found in archive (" << inputModImageName << ")" << '\n';
+
+                return -28;
+            }
+
+            unsigned int argEndIdx = (unsigned int)( expandedEmbedList.size() + foundMembers.size() );
+
+            for ( size_t memberIdx : foundMembers )
+            {
+                archiveModuleNames.push_back( archivePath + ":" + archive->GetMemberPath( memberIdx ) );
+
+                expandedEmbedList.push_back( archiveModuleNames.back().c_str() );
+                expandedModuleOptions.push_back( moduleOptions[ argIdx ] );
+
+                archiveModuleSource source;
+                source.archive = archive;
+                source.memberIdx = memberIdx;
+                source.argEndIdx = argEndIdx;
+
+                moduleArchiveSources.push_back( std::move( source ) );
+            }
+        }
+
+        toEmbedList = std::move( expandedEmbedList );
+        moduleOptions = std::move( expandedModuleOptions );
+
+        numberModules = (unsigned int)toEmbedList.size();
+    }
+
     // Create a nice debug string.
     {
         std::cout << "loading: \"" << inputExecImageName << "\"";
@@ -1824,7 +2763,13 @@ int main( int argc, char *argv[] )
             std::cout << ", \"" << inputModImageName << "\"";
         }
 
-        std::cout << std::endl << std::endl;
+        std::cout << "\n\n";
+
+        events.Emit( "start", EventLog::fields()
+            .AddString( "exe", inputExecImageName )
+            .AddString( "output", outputModImageName )
+            .AddNumber( "modules", numberModules )
+        );
     }
 
     // TODO: create a code building environment and make the DLL embedding a method of it.
@@ -1833,27 +2778,99 @@ int main( int argc, char *argv[] )
 
     int iReturnCode;
 
+    // Module images are read in the background while previous work is being done.
+    // We stay one module ahead so that memory usage is bounded.
+    std::vector <std::unique_ptr <PEStreamPrefetch>> modulePrefetchers( numberModules );
+
+    // Keeps asmjit memory around between code generation jobs.
+    asmjitshared::CodeGenContext codeGenContext;
+
+    // Memory statistics are printed at phase boundaries if requested.
+    if ( doMemoryStats && !PEMemoryTracker::HasAllocationTags() )
+    {
+        std::cout << "note: peframework is built without PEFRAMEWORK_MEMORY_TAGS, so only section data and asmjit code are counted" << "\n\n";
+    }
+
+    auto finishMemoryPhase = [&]( const char *phaseName )
+    {
+        if ( doMemoryStats )
+        {
+            PrintMemoryStats( phaseName );
+
+            PEMemoryTracker::BeginPhase();
+        }
+    };
+
+    auto prefetchModule = [&]( unsigned int modIdx )
+    {
+        if ( modIdx < numberModules )
+        {
+            const archiveModuleSource& archiveSource = moduleArchiveSources[ modIdx ];
+
+            if ( archiveSource.archive == nullptr )
+            {
+                if ( !modulePrefetchers[ modIdx ] )
+                {
+                    modulePrefetchers[ modIdx ] = std::make_unique <PEStreamPrefetch> ( toEmbedList[ modIdx ] );
+                }
+                return;
+            }
+
+            // Modules that an archive argument matched are decompressed in parallel, but only
+            // a few ahead of the embedding so that threads and decompressed data stay bounded.
+            unsigned int prefetchEndIdx = std::min( archiveSource.argEndIdx, modIdx + MAX_ARCHIVE_PREFETCH_COUNT );
+
+            for ( unsigned int argModIdx = modIdx; argModIdx < prefetchEndIdx; argModIdx++ )
+            {
+                if ( !modulePrefetchers[ argModIdx ] )
+                {
+                    const archiveModuleSource& memberSource = moduleArchiveSources[ argModIdx ];
+
+                    modulePrefetchers[ argModIdx ] = std::make_unique <PEStreamPrefetch> ( memberSource.archive, memberSource.memberIdx );
+                }
+            }
+        }
+    };
+
     try
     {
+        // Read the first module while the executable is being parsed.
+        prefetchModule( 0 );
+
         // Load both PE images.
+        // The executable stays open so that its debug data and certificates can be copied
+        // straight over when writing, unless we are about to overwrite it.
+        std::fstream exeFileStream;
+        PEStreamSTL exePEStream( &exeFileStream );
+
         PEFile exeImage;
         {
-            std::cout << "loading executable image (" << inputExecImageName << ")" << std::endl;
+            std::cout << "loading executable image (" << inputExecImageName << ")" << '\n';
 
-            std::fstream stlFileStream( inputExecImageName, std::ios::binary | std::ios::in );
+            exeFileStream.open( inputExecImageName, std::ios::binary | std::ios::in );
 
-            if ( !stlFileStream.good() )
+            if ( !exeFileStream.good() )
             {
-                std::cout << "failed to load executable image" << std::endl;
+                std::cout << "failed to load executable image" << '\n';
 
                 return -1;
             }
 
-            PEStreamSTL peStream( &stlFileStream );
+            std::error_code sameFileError;
+            bool deferFileSpaceData = ( std::filesystem::equivalent( inputExecImageName, outputModImageName, sameFileError ) == false );
 
-            exeImage.LoadFromDisk( &peStream );
+            exeImage.LoadFromDisk( &exePEStream, deferFileSpaceData );
         }
 
+        events.Emit( "exe_loaded", EventLog::fields()
+            .AddNumber( "sections", exeImage.GetSectionCount() )
+            .AddNumber( "imports", (std::int64_t)exeImage.imports.GetCount() )
+            .AddNumber( "exports", (std::int64_t)exeImage.exportDir.functions.GetCount() )
+            .AddBool( "relocatable", exeImage.HasRelocationInfo() )
+        );
+
+        finishMemoryPhase( "loading executable" );
+
         // Initialize the environment.
         std::uint16_t exeMachineType = exeImage.pe_finfo.machine_id;
 
@@ -1880,7 +2897,7 @@ int main( int argc, char *argv[] )
 
             archPointerSize = 4;
 
-            std::cout << "architecture: 32bit" << std::endl;
+            std::cout << "architecture: 32bit" << '\n';
         }
         else if ( exeMachineType == PEL_IMAGE_FILE_MACHINE_AMD64 )
         {
@@ -1888,7 +2905,7 @@ int main( int argc, char *argv[] )
 
             archPointerSize = 8;
 
-            std::cout << "architecture: 64bit" << std::endl;
+            std::cout << "architecture: 64bit" << '\n';
         }
         else
         {
@@ -1902,14 +2919,63 @@ int main( int argc, char *argv[] )
         // This allows us to do specialized patching according to rules of PE merging.
         asmjit::CodeInfo asmCodeInfo( genCodeArch );
 
-        asmjit::CodeHolder asmCodeHolder;
-        asmCodeHolder.init( asmCodeInfo );
+        asmjit::CodeHolder *asmCodeHolderPtr = codeGenContext.BeginJob( asmCodeInfo );
+
+        if ( asmCodeHolderPtr == nullptr )
+        {
+            throw runtime_exception( -23, "failed to initialize asmjit code holder" );
+        }
+
+        asmjit::CodeHolder& asmCodeHolder = *asmCodeHolderPtr;
 
         // We need to remember a label of the entry point.
         asmjit::Label entryPointLabel;
+
+        // Address map of the output image, if requested.
+        ImageAddressMap addrMap;
+
+        // Pages touched during startup, if requested.
+        StartupPageHints startHints;
+
+        if ( startHintsFileName != nullptr && initRVAListFileName != nullptr )
+        {
+            if ( !startHints.LoadRVAList( initRVAListFileName ) )
+            {
+                throw runtime_exception( -25, "failed to read init-time RVA list" );
+            }
+        }
+
+        struct stubLabelInfo
+        {
+            asmjit::Label label;
+            std::string owner;
+            std::string name;
+        };
+
+        std::vector <stubLabelInfo> stubLabels;
+
         {
             AssemblyEnvironment asmEnv( exeImage, &asmCodeHolder );
 
+            if ( mapFileName != nullptr )
+            {
+                asmEnv.addrMap = &addrMap;
+            }
+
+            if ( startHintsFileName != nullptr )
+            {
+                asmEnv.startHints = &startHints;
+            }
+
+            std::unique_ptr <ModuleArenaCache> arenaCache;
+
+            if ( arenaCacheDir != nullptr )
+            {
+                arenaCache = std::make_unique <ModuleArenaCache> ( arenaCacheDir );
+
+                asmEnv.arenaCache = arenaCache.get();
+            }
+
             asmjit::X86Assembler& x86_asm = asmEnv.x86_asm;
 
             // Now the entry point starts.
@@ -1930,7 +2996,7 @@ int main( int argc, char *argv[] )
             // one because it is used for version detection by some executable logic.
             if ( doFixEntryPoint )
             {
-                std::cout << "adjusting executable entry point to old on startup ..." << std::endl;
+                std::cout << "adjusting executable entry point to old on startup ..." << '\n';
 
                 PEFile::PESection metaSection;
                 metaSection.shortName = ".meta";
@@ -2074,27 +3140,113 @@ int main( int argc, char *argv[] )
                 }
             }
 
+            // If requested, create the table that the entry stub writes startup timings into.
+            std::uint32_t stubProfileTableRVA = 0;
+
+            if ( doStubProfile )
+            {
+                std::cout << "generating startup profiling table ..." << '\n';
+
+                PEFile::PESection profSection;
+                profSection.shortName = ".stubprf";
+                profSection.chars.sect_mem_write = true;
+
+                std::uint32_t profTableSize = (std::uint32_t)( sizeof(stubProfileHeader) + sizeof(stubProfileEntry) * numberModules );
+
+                PEFile::PESectionAllocation profTableAlloc;
+                profSection.Allocate( profTableAlloc, profTableSize, sizeof(std::uint64_t) );
+
+                // Write the initial table contents.
+                {
+                    stubProfileHeader header;
+                    memcpy( header.magic, "D2XSPROF", sizeof(header.magic) );
+                    header.version = STUB_PROFILE_VERSION;
+                    header.numEntries = numberModules;
+                    header.entrySize = sizeof(stubProfileEntry);
+                    header.reserved = 0;
+
+                    profTableAlloc.WriteToSection( &header, sizeof(header), 0 );
+
+                    for ( unsigned int n = 0; n < numberModules; n++ )
+                    {
+                        stubProfileEntry entry;
+                        memset( &entry, 0, sizeof(entry) );
+                        strncpy( entry.moduleName, FetchFileName( toEmbedList[ n ] ), sizeof(entry.moduleName) - 1 );
+
+                        profTableAlloc.WriteToSection( &entry, sizeof(entry), (std::uint32_t)( sizeof(header) + sizeof(entry) * n ) );
+                    }
+                }
+
+                profSection.Finalize();
+
+                PEFile::PESection *profSectInside = exeImage.AddSection( std::move( profSection ) );
+
+                if ( profSectInside == nullptr )
+                {
+                    throw runtime_exception( -22, "failed to allocate startup profiling section in executable image" );
+                }
+
+                stubProfileTableRVA = profTableAlloc.ResolveOffset( 0 );
+
+                // The stub writes into the table during startup.
+                startHints.AddRange( stubProfileTableRVA, profTableSize );
+
+                // Export the table so that it can be found at runtime.
+                {
+                    size_t profExportOrd = exeImage.exportDir.functions.GetCount();
+
+                    PEFile::PEExportDir::func profExport;
+                    profExport.expRef = profTableAlloc;
+                    profExport.isForwarder = false;
+
+                    exeImage.exportDir.functions.AddToBack( std::move( profExport ) );
+
+                    PEFile::PEExportDir::mappedName profExportName;
+                    profExportName.name = STUB_PROFILE_EXPORT_NAME;
+                    exeImage.exportDir.funcNameMap.Set( std::move( profExportName ), std::move( profExportOrd ) );
+
+                    // Rewrite things.
+                    exeImage.exportDir.allocEntry = PEFile::PESectionAllocation();
+                    exeImage.exportDir.funcAddressAllocEntry = PEFile::PESectionAllocation();
+                    exeImage.exportDir.funcNamesAllocEntry = PEFile::PESectionAllocation();
+                }
+
+                // The table has to stay allocated until the image is written.
+                asmEnv.persistentAllocations.push_back( std::move( profTableAlloc ) );
+            }
+
             // Embed each requested image.
             for ( unsigned int n = 0; n < numberModules; n++ )
             {
                 const char *inputModImageName = toEmbedList[ n ];
 
                 PEFile moduleImage;
+                std::uint64_t moduleDataSize;
                 {
-                    std::cout << "loading module image (" << inputModImageName << ")" << std::endl;
+                    std::cout << "loading module image (" << inputModImageName << ")" << '\n';
 
-                    std::fstream stlFileStream( inputModImageName, std::ios::binary | std::ios::in );
+                    prefetchModule( n );
 
-                    if ( !stlFileStream.good() )
+                    // Overlap reading of the next module with embedding of this one.
+                    prefetchModule( n + 1 );
+
+                    std::unique_ptr <PEStreamPrefetch> peStream = std::move( modulePrefetchers[ n ] );
+
+                    if ( !peStream->WaitForData() )
                     {
-                        std::cout << "failed to load module image" << std::endl;
+                        std::cout << "failed to load module image" << '\n';
 
                         return -2;
                     }
 
-                    PEStreamSTL peStream( &stlFileStream );
+                    moduleImage.LoadFromDisk( peStream.get() );
 
-                    moduleImage.LoadFromDisk( &peStream );
+                    moduleDataSize = peStream->GetDataSize();
+
+                    if ( asmEnv.arenaCache != nullptr && moduleOptions[ n ].useArenaCache )
+                    {
+                        asmEnv.moduleContentHash = ModuleArenaCache::HashData( peStream->GetData(), peStream->GetDataSize() );
+                    }
                 }
 
                 std::uint16_t modMachineType = moduleImage.pe_finfo.machine_id;
@@ -2102,7 +3254,7 @@ int main( int argc, char *argv[] )
                 // Check that both images are of same machine type.
                 if ( exeMachineType != modMachineType )
                 {
-                    std::cout << "machine types of images do not match" << std::endl;
+                    std::cout << "machine types of images do not match" << '\n';
 
                     return -3;
                 }
@@ -2110,11 +3262,34 @@ int main( int argc, char *argv[] )
                 // Fetch module name.
                 const char *moduleFileName = FetchFileName( inputModImageName );
 
+                // Remember where the initialization code of this module starts.
+                if ( mapFileName != nullptr )
+                {
+                    asmjit::Label moduleInitLabel = x86_asm.newLabel();
+                    x86_asm.bind( moduleInitLabel );
+
+                    stubLabels.push_back( { moduleInitLabel, moduleFileName, "module init" } );
+                }
+
+                if ( stubProfileTableRVA != 0 )
+                {
+                    asmEnv.stubProfileEntryRVA = (std::uint32_t)( stubProfileTableRVA + sizeof(stubProfileHeader) + sizeof(stubProfileEntry) * n );
+                }
+
+                // Embedding moves the contents out of the module, so we count beforehand.
+                EventLog::fields moduleFields;
+                moduleFields
+                    .AddNumber( "index", n )
+                    .AddString( "module", inputModImageName )
+                    .AddNumber( "bytes", (std::int64_t)moduleDataSize )
+                    .AddNumber( "sections", moduleImage.GetSectionCount() )
+                    .AddNumber( "imports", (std::int64_t)moduleImage.imports.GetCount() )
+                    .AddNumber( "exports", (std::int64_t)moduleImage.exportDir.functions.GetCount() );
+
                 // Perform the embedding.
                 int statusEmbed = asmEnv.EmbedModuleIntoExecutable(
                     moduleImage, requiresRelocations, moduleFileName,
-                    doInjectMatchingImports, doTakeoverExports, doIgnoreResources, doFixEntrypointExecutable, markAllSectionsExecutable,
-                    archPointerSize
+                    moduleOptions[ n ], archPointerSize
                 );
 
                 if ( statusEmbed != 0 )
@@ -2122,61 +3297,192 @@ int main( int argc, char *argv[] )
                     return statusEmbed;
                 }
 
+                events.Emit( "module_embedded", moduleFields );
+
+                finishMemoryPhase( moduleFileName );
+
                 // Print some seperation for easier log viewing.
                 if ( n + 1 != numberModules )
                 {
-                    std::cout << std::endl;
+                    std::cout << '\n';
                 }
             }
 
+            if ( mapFileName != nullptr )
+            {
+                asmjit::Label exitLabel = x86_asm.newLabel();
+                x86_asm.bind( exitLabel );
+
+                stubLabels.push_back( { exitLabel, "dll2exe", "jump to original entry point" } );
+            }
+
             // We jump to the original executable entry point.
-            x86_asm.jmp( exeImage.peOptHeader.addressOfEntryPointRef.GetRVA() );
+            std::uint32_t origEntryPointRVA = exeImage.peOptHeader.addressOfEntryPointRef.GetRVA();
+
+            startHints.AddRange( origEntryPointRVA, 1 );
+
+            x86_asm.jmp( origEntryPointRVA );
 
             // Finished generating code.
         }
 
         // Notify that there is now a divide between module code generation and asmjit embedding.
-        std::cout << std::endl;
+        std::cout << '\n';
 
         // Commit the code into the buffers.
         asmCodeHolder.sync();
 
+        // asmjit does not allocate through peframework, so account its code buffers by hand.
+        size_t asmCodeBufferSize = 0;
+
+        size_t numAsmSections = asmCodeHolder.getSections().getLength();
+
+        for ( size_t n = 0; n < numAsmSections; n++ )
+        {
+            asmCodeBufferSize += asmCodeHolder.getSectionEntry( n )->getPhysicalSize();
+        }
+
+        PEExternalMemoryScope asmCodeMemory( ePEMemoryTag::ASMJIT, asmCodeBufferSize );
+
         // We have to embed all asmjit sections into our executable aswell.
         {
-            std::cout << "linking asmjit code into executable" << std::endl;
+            std::cout << "linking asmjit code into executable" << '\n';
+
+            PEMemoryTagScope memTag( ePEMemoryTag::ASMJIT );
 
             PEFile::PESectionDataReference entryPointRef;
             bool couldLinkCode = asmjitshared::EmbedASMJITCodeIntoModule( exeImage, requiresRelocations, asmCodeHolder, entryPointLabel, entryPointRef );
 
             if ( !couldLinkCode )
             {
-                std::cout << "failed to link asmjit code into executable" << std::endl;
+                std::cout << "failed to link asmjit code into executable" << '\n';
 
                 return -10;
             }
 
+            // The entire stub runs at startup.
+            {
+                PEFile::PESection *stubSect = entryPointRef.GetSection();
+
+                startHints.AddRange( stubSect->GetVirtualAddress(), stubSect->GetVirtualSize() );
+            }
+
+            // Put the generated code into the address map.
+            // All labels were bound inside of the section of the entry point.
+            if ( mapFileName != nullptr )
+            {
+                PEFile::PESection *stubSect = entryPointRef.GetSection();
+
+                std::uint32_t stubCodeSize = (std::uint32_t)stubSect->stream.Size();
+
+                addrMap.AddEntry( ImageAddressMap::eEntryType::SECTION, stubSect->GetVirtualAddress(), stubSect->GetVirtualSize(), "dll2exe", stubSect->shortName.GetConstString() );
+                addrMap.AddEntry( ImageAddressMap::eEntryType::STUB, entryPointRef.GetRVA(), 0, "dll2exe", "entry point" );
+
+                size_t numStubLabels = stubLabels.size();
+
+                for ( size_t n = 0; n < numStubLabels; n++ )
+                {
+                    const stubLabelInfo& info = stubLabels[ n ];
+
+                    std::uint32_t labelOffset = (std::uint32_t)asmCodeHolder.getLabelEntry( info.label )->getOffset();
+
+                    // Code of a label reaches up to the next label.
+                    std::uint32_t labelEndOffset = stubCodeSize;
+
+                    if ( n + 1 < numStubLabels )
+                    {
+                        labelEndOffset = (std::uint32_t)asmCodeHolder.getLabelEntry( stubLabels[ n + 1 ].label )->getOffset();
+                    }
+
+                    addrMap.AddEntry( ImageAddressMap::eEntryType::STUB, stubSect->ResolveRVA( labelOffset ), ( labelEndOffset - labelOffset ), info.owner, info.name );
+                }
+            }
+
             // Make our executable entry point to our newly compiled routine.
             exeImage.peOptHeader.addressOfEntryPointRef = std::move( entryPointRef );
 
             // Finito.
         }
 
+        events.Emit( "linked", EventLog::fields()
+            .AddNumber( "stub_bytes", (std::int64_t)asmCodeBufferSize )
+        );
+
+        finishMemoryPhase( "linking asmjit code" );
+
+        // The generated code has been copied into the executable.
+        codeGenContext.EndJob();
+
+        asmCodeMemory.Release();
+
         // Write out the new executable image.
         {
-            std::cout << "writing output image (" << outputModImageName << ")" << std::endl;
+            std::cout << "writing output image (" << outputModImageName << ")" << '\n';
 
-            std::fstream stlStreamOut( outputModImageName, std::ios::binary | std::ios::out );
+            if ( doMappedOutput )
+            {
+                PEStreamMappedFile peOutStream;
+
+                if ( !peOutStream.Open( outputModImageName ) )
+                {
+                    std::cout << "failed to create output file (" << outputModImageName << ")" << '\n';
 
-            if ( !stlStreamOut.good() )
+                    return -18;
+                }
+
+                exeImage.WriteToStream( &peOutStream );
+
+                if ( !peOutStream.Close() )
+                {
+                    throw runtime_exception( -24, "failed to finalize memory-mapped output file" );
+                }
+            }
+            else
             {
-                std::cout << "failed to create output file (" << outputModImageName << ")" << std::endl;
+                std::fstream stlStreamOut( outputModImageName, std::ios::binary | std::ios::out );
+
+                if ( !stlStreamOut.good() )
+                {
+                    std::cout << "failed to create output file (" << outputModImageName << ")" << '\n';
+
+                    return -18;
+                }
+
+                PEStreamSTL peOutStream( &stlStreamOut );
+
+                exeImage.WriteToStream( &peOutStream );
+            }
+
+            events.Emit( "written", EventLog::fields()
+                .AddString( "output", outputModImageName )
+                .AddNumber( "sections", exeImage.GetSectionCount() )
+                .AddBool( "mapped", doMappedOutput )
+            );
+        }
+
+        // Write the address map after the image layout has been finalized.
+        if ( mapFileName != nullptr )
+        {
+            std::cout << "writing address map (" << mapFileName << ")" << '\n';
+
+            bool couldWriteMap = addrMap.WriteToFile( mapFileName, FetchFileName( outputModImageName ), exeImage.GetImageBase() );
 
-                return -18;
+            if ( !couldWriteMap )
+            {
+                throw runtime_exception( -21, "failed to write address map file" );
             }
+        }
+
+        if ( startHintsFileName != nullptr )
+        {
+            std::cout << "writing startup page hints (" << startHintsFileName << ")" << '\n';
 
-            PEStreamSTL peOutStream( &stlStreamOut );
+            bool couldWriteHints = startHints.WriteToFile( startHintsFileName, FetchFileName( outputModImageName ), exeImage );
 
-            exeImage.WriteToStream( &peOutStream );
+            if ( !couldWriteHints )
+            {
+                throw runtime_exception( -26, "failed to write startup page hints file" );
+            }
         }
 
         // Success!
@@ -2184,7 +3490,14 @@ int main( int argc, char *argv[] )
     }
     catch( peframework_exception& except )
     {
-        std::cout << "error: " << except.desc_str() << std::endl;
+        std::cout << "error: " << except.desc_str() << '\n';
+
+        events.Emit( "error", EventLog::fields()
+            .AddNumber( "code", -42 )
+            .AddString( "name", GetRunResultName( -42 ) )
+            .AddNumber( "peframework_code", (std::int64_t)except.code() )
+            .AddString( "message", except.desc_str() )
+        );
 
         iReturnCode = -42;
 
@@ -2192,12 +3505,37 @@ int main( int argc, char *argv[] )
     }
     catch( runtime_exception& except )
     {
-        std::cout << except.msg << std::endl;
+        std::cout << except.msg << '\n';
+
+        events.Emit( "error", EventLog::fields()
+            .AddNumber( "code", except.error_code )
+            .AddString( "name", GetRunResultName( except.error_code ) )
+            .AddString( "message", except.msg )
+        );
 
         iReturnCode = except.error_code;
 
         // Continue.
     }
 
+    finishMemoryPhase( "end of run" );
+
+    return iReturnCode;
+}
+
+int main( int argc, char *argv[] )
+{
+    EventLog events;
+
+    int iReturnCode = RunEmbedding( argc, argv, events );
+
+    // Every run that got as far as opening the event stream ends with its result.
+    events.Emit( "end", EventLog::fields()
+        .AddNumber( "code", iReturnCode )
+        .AddString( "result", GetRunResultName( iReturnCode ) )
+    );
+
+    events.Close();
+
     return iReturnCode;
 }
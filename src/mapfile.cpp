@@ -0,0 +1,94 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "mapfile.h"
+
+#include <algorithm>
+#include <fstream>
+#include <cstdio>
+
+void ImageAddressMap::AddEntry( eEntryType type, std::uint32_t rva, std::uint32_t size, std::string owner, std::string name )
+{
+    entry newEntry;
+    newEntry.type = type;
+    newEntry.rva = rva;
+    newEntry.size = size;
+    newEntry.owner = std::move( owner );
+    newEntry.name = std::move( name );
+
+    this->entries.push_back( std::move( newEntry ) );
+}
+
+static const char* GetEntryTypeName( ImageAddressMap::eEntryType type )
+{
+    switch( type )
+    {
+    case ImageAddressMap::eEntryType::MODULE:   return "module";
+    case ImageAddressMap::eEntryType::SECTION:  return "section";
+    case ImageAddressMap::eEntryType::STUB:     return "stub";
+    case ImageAddressMap::eEntryType::INIT:     return "init";
+    case ImageAddressMap::eEntryType::EXPORT:   return "export";
+    }
+
+    return "unknown";
+}
+
+bool ImageAddressMap::WriteToFile( const char *path, const char *imageName, std::uint64_t imageBase ) const
+{
+    std::ofstream mapStream( path, std::ios::out | std::ios::trunc );
+
+    if ( !mapStream.good() )
+    {
+        return false;
+    }
+
+    // Sort a copy of the entries by address. Containers come before their contents
+    // on the same address, so a module line precedes its first section, etc.
+    std::vector <const entry*> sortedEntries;
+    sortedEntries.reserve( this->entries.size() );
+
+    for ( const entry& item : this->entries )
+    {
+        sortedEntries.push_back( &item );
+    }
+
+    std::stable_sort( sortedEntries.begin(), sortedEntries.end(),
+        []( const entry *left, const entry *right )
+    {
+        if ( left->rva != right->rva )
+        {
+            return ( left->rva < right->rva );
+        }
+
+        return ( left->type < right->type );
+    });
+
+    char lineBuf[ 128 ];
+
+    mapStream << " " << imageName << std::endl << std::endl;
+
+    snprintf( lineBuf, sizeof(lineBuf), " Preferred load address is %016llx", (unsigned long long)imageBase );
+    mapStream << lineBuf << std::endl << std::endl;
+
+    mapStream << "  Rva       Va                Length    Type     Owner                            Name" << std::endl << std::endl;
+
+    for ( const entry *item : sortedEntries )
+    {
+        snprintf( lineBuf, sizeof(lineBuf), "  %08x  %016llx  %08x  %-8s ",
+            item->rva, (unsigned long long)( imageBase + item->rva ), item->size, GetEntryTypeName( item->type )
+        );
+
+        mapStream << lineBuf;
+
+        // Pad the owner column; long module names just push the name column to the right.
+        mapStream << item->owner;
+
+        for ( size_t n = item->owner.size(); n < 32; n++ )
+        {
+            mapStream << ' ';
+        }
+
+        mapStream << ' ' << item->name << std::endl;
+    }
+
+    return mapStream.good();
+}
@@ -0,0 +1,41 @@
+#ifndef _IMAGE_MAP_FILE_
+#define _IMAGE_MAP_FILE_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Linker-style address map of the merged executable image.
+// Used for offline symbolization of addresses inside of embedded modules.
+struct ImageAddressMap
+{
+    enum class eEntryType
+    {
+        MODULE,
+        SECTION,
+        STUB,
+        INIT,
+        EXPORT
+    };
+
+    void AddEntry( eEntryType type, std::uint32_t rva, std::uint32_t size, std::string owner, std::string name );
+
+    inline size_t GetEntryCount( void ) const       { return this->entries.size(); }
+
+    // Writes all entries sorted by RVA into a text file.
+    bool WriteToFile( const char *path, const char *imageName, std::uint64_t imageBase ) const;
+
+private:
+    struct entry
+    {
+        eEntryType type;
+        std::uint32_t rva;
+        std::uint32_t size;
+        std::string owner;
+        std::string name;
+    };
+
+    std::vector <entry> entries;
+};
+
+#endif //_IMAGE_MAP_FILE_
@@ -0,0 +1,348 @@
+#include "mappedstream.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif //_WIN32
+
+// Files are grown in steps of at least this size so that we do not remap on every write.
+static const pe_file_ptr_t MAPPING_GROW_SIZE = ( 16 * 1024 * 1024 );
+
+// Blocks are split into chunks of this size for the copying threads.
+static const size_t COPY_CHUNK_SIZE = ( 4 * 1024 * 1024 );
+
+PEStreamMappedFile::PEStreamMappedFile( void )
+{
+#ifdef _WIN32
+    this->fileHandle = INVALID_HANDLE_VALUE;
+    this->mappingHandle = nullptr;
+#else
+    this->fileDesc = -1;
+#endif //_WIN32
+
+    this->mappedData = nullptr;
+    this->mappedSize = 0;
+    this->dataSize = 0;
+    this->seekPtr = 0;
+}
+
+PEStreamMappedFile::~PEStreamMappedFile( void )
+{
+    this->Close();
+}
+
+bool PEStreamMappedFile::Open( const char *path )
+{
+    this->Close();
+
+#ifdef _WIN32
+    HANDLE hFile = CreateFileA( path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr );
+
+    if ( hFile == INVALID_HANDLE_VALUE )
+    {
+        return false;
+    }
+
+    this->fileHandle = hFile;
+#else
+    int fd = open( path, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+
+    if ( fd == -1 )
+    {
+        return false;
+    }
+
+    this->fileDesc = fd;
+#endif //_WIN32
+
+    this->dataSize = 0;
+    this->seekPtr = 0;
+
+    return true;
+}
+
+void PEStreamMappedFile::UnmapFile( void )
+{
+#ifdef _WIN32
+    if ( this->mappedData != nullptr )
+    {
+        UnmapViewOfFile( this->mappedData );
+    }
+
+    if ( this->mappingHandle != nullptr )
+    {
+        CloseHandle( (HANDLE)this->mappingHandle );
+
+        this->mappingHandle = nullptr;
+    }
+#else
+    if ( this->mappedData != nullptr )
+    {
+        munmap( this->mappedData, (size_t)this->mappedSize );
+    }
+#endif //_WIN32
+
+    this->mappedData = nullptr;
+    this->mappedSize = 0;
+}
+
+bool PEStreamMappedFile::Close( void )
+{
+    bool success = true;
+
+    this->UnmapFile();
+
+#ifdef _WIN32
+    if ( this->fileHandle != INVALID_HANDLE_VALUE )
+    {
+        HANDLE hFile = (HANDLE)this->fileHandle;
+
+        // Trim the over-allocated space.
+        LARGE_INTEGER endPos;
+        endPos.QuadPart = this->dataSize;
+
+        if ( !SetFilePointerEx( hFile, endPos, nullptr, FILE_BEGIN ) || !SetEndOfFile( hFile ) )
+        {
+            success = false;
+        }
+
+        CloseHandle( hFile );
+
+        this->fileHandle = INVALID_HANDLE_VALUE;
+    }
+#else
+    if ( this->fileDesc != -1 )
+    {
+        // Trim the over-allocated space.
+        if ( ftruncate( this->fileDesc, (off_t)this->dataSize ) != 0 )
+        {
+            success = false;
+        }
+
+        if ( close( this->fileDesc ) != 0 )
+        {
+            success = false;
+        }
+
+        this->fileDesc = -1;
+    }
+#endif //_WIN32
+
+    return success;
+}
+
+bool PEStreamMappedFile::EnsureMappedSize( pe_file_ptr_t minSize )
+{
+    if ( minSize <= this->mappedSize )
+    {
+        return true;
+    }
+
+    pe_file_ptr_t newSize = std::max( minSize, this->mappedSize + std::max( this->mappedSize, MAPPING_GROW_SIZE ) );
+
+    // The file is resized while it is not mapped.
+    this->UnmapFile();
+
+#ifdef _WIN32
+    if ( this->fileHandle == INVALID_HANDLE_VALUE )
+    {
+        return false;
+    }
+
+    // Creating a mapping that is bigger than the file extends the file.
+    HANDLE hMapping = CreateFileMappingA( (HANDLE)this->fileHandle, nullptr, PAGE_READWRITE, (DWORD)( newSize >> 32 ), (DWORD)( newSize & 0xFFFFFFFF ), nullptr );
+
+    if ( hMapping == nullptr )
+    {
+        return false;
+    }
+
+    void *viewPtr = MapViewOfFile( hMapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, (SIZE_T)newSize );
+
+    if ( viewPtr == nullptr )
+    {
+        CloseHandle( hMapping );
+        return false;
+    }
+
+    this->mappingHandle = hMapping;
+#else
+    if ( this->fileDesc == -1 )
+    {
+        return false;
+    }
+
+    if ( ftruncate( this->fileDesc, (off_t)newSize ) != 0 )
+    {
+        return false;
+    }
+
+    void *viewPtr = mmap( nullptr, (size_t)newSize, PROT_READ | PROT_WRITE, MAP_SHARED, this->fileDesc, 0 );
+
+    if ( viewPtr == MAP_FAILED )
+    {
+        return false;
+    }
+#endif //_WIN32
+
+    this->mappedData = (char*)viewPtr;
+    this->mappedSize = newSize;
+
+    return true;
+}
+
+size_t PEStreamMappedFile::Read( void *buf, size_t readCount )
+{
+    pe_file_ptr_t seekPtr = this->seekPtr;
+
+    if ( seekPtr >= this->dataSize )
+    {
+        return 0;
+    }
+
+    size_t canRead = std::min( readCount, (size_t)( this->dataSize - seekPtr ) );
+
+    memcpy( buf, this->mappedData + seekPtr, canRead );
+
+    this->seekPtr = ( seekPtr + (pe_file_ptr_t)canRead );
+
+    return canRead;
+}
+
+bool PEStreamMappedFile::Write( const void *buf, size_t writeCount )
+{
+    pe_file_ptr_t seekPtr = this->seekPtr;
+    pe_file_ptr_t writeEnd = ( seekPtr + (pe_file_ptr_t)writeCount );
+
+    if ( !this->EnsureMappedSize( writeEnd ) )
+    {
+        return false;
+    }
+
+    memcpy( this->mappedData + seekPtr, buf, writeCount );
+
+    this->seekPtr = writeEnd;
+
+    if ( writeEnd > this->dataSize )
+    {
+        this->dataSize = writeEnd;
+    }
+
+    return true;
+}
+
+bool PEStreamMappedFile::Seek( pe_file_ptr_t ptr )
+{
+    if ( ptr < 0 )
+    {
+        return false;
+    }
+
+    this->seekPtr = ptr;
+
+    return true;
+}
+
+pe_file_ptr_t PEStreamMappedFile::Tell( void ) const
+{
+    return this->seekPtr;
+}
+
+bool PEStreamMappedFile::WriteBlocks( const PEStreamWriteBlock *blocks, size_t numBlocks )
+{
+    // Map the entire range first, so that the threads do not have to.
+    pe_file_ptr_t writeEnd = 0;
+
+    for ( size_t n = 0; n < numBlocks; n++ )
+    {
+        const PEStreamWriteBlock& block = blocks[ n ];
+
+        if ( block.offset < 0 )
+        {
+            return false;
+        }
+
+        writeEnd = std::max( writeEnd, block.offset + (pe_file_ptr_t)block.size );
+    }
+
+    if ( !this->EnsureMappedSize( writeEnd ) )
+    {
+        return false;
+    }
+
+    // Split big blocks so that the work is spread evenly.
+    std::vector <PEStreamWriteBlock> chunks;
+    size_t totalSize = 0;
+
+    for ( size_t n = 0; n < numBlocks; n++ )
+    {
+        const PEStreamWriteBlock& block = blocks[ n ];
+
+        for ( size_t chunkOff = 0; chunkOff < block.size; chunkOff += COPY_CHUNK_SIZE )
+        {
+            PEStreamWriteBlock chunk;
+            chunk.offset = ( block.offset + (pe_file_ptr_t)chunkOff );
+            chunk.data = ( (const char*)block.data + chunkOff );
+            chunk.size = std::min( COPY_CHUNK_SIZE, block.size - chunkOff );
+
+            chunks.push_back( chunk );
+        }
+
+        totalSize += block.size;
+    }
+
+    char *mappedData = this->mappedData;
+
+    std::atomic <size_t> nextChunk( 0 );
+
+    auto copyChunks = [&]( void )
+    {
+        while ( true )
+        {
+            size_t chunkIdx = nextChunk.fetch_add( 1 );
+
+            if ( chunkIdx >= chunks.size() )
+            {
+                break;
+            }
+
+            const PEStreamWriteBlock& chunk = chunks[ chunkIdx ];
+
+            memcpy( mappedData + chunk.offset, chunk.data, chunk.size );
+        }
+    };
+
+    // Small images are not worth the thread startup.
+    size_t numThreads = std::min( (size_t)std::thread::hardware_concurrency(), ( totalSize / COPY_CHUNK_SIZE ) );
+
+    std::vector <std::thread> copyThreads;
+
+    for ( size_t n = 1; n < numThreads; n++ )
+    {
+        copyThreads.emplace_back( copyChunks );
+    }
+
+    copyChunks();
+
+    for ( std::thread& copyThread : copyThreads )
+    {
+        copyThread.join();
+    }
+
+    if ( writeEnd > this->dataSize )
+    {
+        this->dataSize = writeEnd;
+    }
+
+    return true;
+}
@@ -0,0 +1,47 @@
+#ifndef _MAPPED_FILE_STREAM_
+#define _MAPPED_FILE_STREAM_
+
+#include <peframework.h>
+
+// Output stream that writes into a memory-mapped file. The file grows as data is written and is
+// trimmed to the written size on Close. Blocks given to WriteBlocks (the section data of an
+// image) are copied on multiple threads.
+struct PEStreamMappedFile : public PEStream
+{
+    PEStreamMappedFile( void );
+    ~PEStreamMappedFile( void );
+
+    // Creates or truncates the file at path.
+    bool Open( const char *path );
+
+    // Unmaps the file and sets its size to the end of the written data.
+    bool Close( void );
+
+    size_t Read( void *buf, size_t readCount ) override;
+    bool Write( const void *buf, size_t writeCount ) override;
+    bool Seek( pe_file_ptr_t ptr ) override;
+    pe_file_ptr_t Tell( void ) const override;
+
+    bool WriteBlocks( const PEStreamWriteBlock *blocks, size_t numBlocks ) override;
+
+private:
+    bool EnsureMappedSize( pe_file_ptr_t minSize );
+    void UnmapFile( void );
+
+#ifdef _WIN32
+    void *fileHandle;
+    void *mappingHandle;
+#else
+    int fileDesc;
+#endif //_WIN32
+
+    char *mappedData;
+    pe_file_ptr_t mappedSize;
+
+    // End of the written data.
+    pe_file_ptr_t dataSize;
+
+    pe_file_ptr_t seekPtr;
+};
+
+#endif //_MAPPED_FILE_STREAM_
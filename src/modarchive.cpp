@@ -0,0 +1,1003 @@
+#include "modarchive.h"
+
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cctype>
+
+static inline std::uint16_t ReadLE16( const unsigned char *ptr )
+{
+    return (std::uint16_t)( ptr[0] | ( ptr[1] << 8 ) );
+}
+
+static inline std::uint32_t ReadLE32( const unsigned char *ptr )
+{
+    return ( (std::uint32_t)ptr[0] | ( (std::uint32_t)ptr[1] << 8 ) | ( (std::uint32_t)ptr[2] << 16 ) | ( (std::uint32_t)ptr[3] << 24 ) );
+}
+
+static inline char NormalizePathChar( char c )
+{
+    if ( c == '\\' )
+    {
+        return '/';
+    }
+
+    return (char)tolower( (unsigned char)c );
+}
+
+static bool HasExtension( const std::string& path, const char *ext )
+{
+    size_t extLen = strlen( ext );
+
+    if ( path.size() < extLen )
+    {
+        return false;
+    }
+
+    const char *pathExt = ( path.c_str() + path.size() - extLen );
+
+    for ( size_t n = 0; n < extLen; n++ )
+    {
+        if ( NormalizePathChar( pathExt[n] ) != ext[n] )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool ReadAt( std::istream& stream, std::uint64_t offset, void *buf, size_t readCount )
+{
+    stream.clear();
+    stream.seekg( (std::streamoff)offset );
+
+    if ( !stream.good() )
+    {
+        return false;
+    }
+
+    stream.read( (char*)buf, (std::streamsize)readCount );
+
+    return ( stream.gcount() == (std::streamsize)readCount );
+}
+
+static std::uint32_t CalculateCRC32( const void *data, size_t dataSize )
+{
+    struct crcTable
+    {
+        crcTable( void )
+        {
+            for ( std::uint32_t n = 0; n < 256; n++ )
+            {
+                std::uint32_t value = n;
+
+                for ( unsigned int k = 0; k < 8; k++ )
+                {
+                    value = ( ( value & 1 ) ? ( 0xEDB88320 ^ ( value >> 1 ) ) : ( value >> 1 ) );
+                }
+
+                this->entries[ n ] = value;
+            }
+        }
+
+        std::uint32_t entries[ 256 ];
+    };
+
+    static const crcTable table;
+
+    const unsigned char *bytes = (const unsigned char*)data;
+
+    std::uint32_t crc = 0xFFFFFFFF;
+
+    for ( size_t n = 0; n < dataSize; n++ )
+    {
+        crc = ( table.entries[ ( crc ^ bytes[n] ) & 0xFF ] ^ ( crc >> 8 ) );
+    }
+
+    return ( crc ^ 0xFFFFFFFF );
+}
+
+// Decoder for raw deflate streams (RFC 1951) of a known decompressed size.
+struct inflateDecoder
+{
+    inline inflateDecoder( const unsigned char *inData, size_t inSize, char *outData, size_t outSize )
+    {
+        this->inData = inData;
+        this->inSize = inSize;
+        this->inPos = 0;
+        this->bitBuf = 0;
+        this->bitCount = 0;
+        this->outData = outData;
+        this->outSize = outSize;
+        this->outPos = 0;
+    }
+
+    bool Decode( void )
+    {
+        bool isLastBlock;
+
+        do
+        {
+            std::uint32_t blockHeader;
+
+            if ( !this->GetBits( 3, blockHeader ) )
+            {
+                return false;
+            }
+
+            isLastBlock = ( ( blockHeader & 1 ) != 0 );
+
+            std::uint32_t blockType = ( blockHeader >> 1 );
+
+            bool blockSuccess;
+
+            if ( blockType == 0 )
+            {
+                blockSuccess = this->DecodeStoredBlock();
+            }
+            else if ( blockType == 1 )
+            {
+                blockSuccess = this->DecodeFixedBlock();
+            }
+            else if ( blockType == 2 )
+            {
+                blockSuccess = this->DecodeDynamicBlock();
+            }
+            else
+            {
+                blockSuccess = false;
+            }
+
+            if ( !blockSuccess )
+            {
+                return false;
+            }
+        }
+        while ( !isLastBlock );
+
+        return ( this->outPos == this->outSize );
+    }
+
+private:
+    static constexpr unsigned int MAX_CODE_BITS = 15;
+
+    struct huffmanTable
+    {
+        std::uint16_t counts[ MAX_CODE_BITS + 1 ];
+        std::uint16_t symbols[ 288 ];
+
+        // Returns false for over-subscribed code lengths. Incomplete codes are only allowed
+        // if the caller accepts them; decoding fails if one of the unused codes shows up.
+        bool Construct( const std::uint8_t *codeLengths, unsigned int numSymbols, bool allowIncomplete )
+        {
+            memset( this->counts, 0, sizeof(this->counts) );
+
+            for ( unsigned int sym = 0; sym < numSymbols; sym++ )
+            {
+                this->counts[ codeLengths[ sym ] ]++;
+            }
+
+            if ( this->counts[ 0 ] == numSymbols )
+            {
+                return allowIncomplete;
+            }
+
+            int codesLeft = 1;
+
+            for ( unsigned int len = 1; len <= MAX_CODE_BITS; len++ )
+            {
+                codesLeft <<= 1;
+                codesLeft -= this->counts[ len ];
+
+                if ( codesLeft < 0 )
+                {
+                    return false;
+                }
+            }
+
+            if ( codesLeft > 0 && !allowIncomplete )
+            {
+                return false;
+            }
+
+            std::uint16_t offsets[ MAX_CODE_BITS + 1 ];
+            offsets[ 1 ] = 0;
+
+            for ( unsigned int len = 1; len < MAX_CODE_BITS; len++ )
+            {
+                offsets[ len + 1 ] = ( offsets[ len ] + this->counts[ len ] );
+            }
+
+            for ( unsigned int sym = 0; sym < numSymbols; sym++ )
+            {
+                if ( codeLengths[ sym ] != 0 )
+                {
+                    this->symbols[ offsets[ codeLengths[ sym ] ]++ ] = (std::uint16_t)sym;
+                }
+            }
+
+            return true;
+        }
+    };
+
+    inline bool GetBits( unsigned int numBits, std::uint32_t& valueOut )
+    {
+        std::uint32_t bitBuf = this->bitBuf;
+        unsigned int bitCount = this->bitCount;
+
+        while ( bitCount < numBits )
+        {
+            if ( this->inPos == this->inSize )
+            {
+                return false;
+            }
+
+            bitBuf |= ( (std::uint32_t)this->inData[ this->inPos++ ] << bitCount );
+            bitCount += 8;
+        }
+
+        valueOut = ( bitBuf & ( ( 1u << numBits ) - 1 ) );
+
+        this->bitBuf = ( bitBuf >> numBits );
+        this->bitCount = ( bitCount - numBits );
+
+        return true;
+    }
+
+    // Codes are stored starting with their most significant bit.
+    inline bool DecodeSymbol( const huffmanTable& table, std::uint32_t& symOut )
+    {
+        int code = 0;
+        int first = 0;
+        int index = 0;
+
+        for ( unsigned int len = 1; len <= MAX_CODE_BITS; len++ )
+        {
+            std::uint32_t bit;
+
+            if ( !this->GetBits( 1, bit ) )
+            {
+                return false;
+            }
+
+            code |= (int)bit;
+
+            int count = table.counts[ len ];
+
+            if ( code - count < first )
+            {
+                symOut = table.symbols[ index + ( code - first ) ];
+                return true;
+            }
+
+            index += count;
+            first += count;
+            first <<= 1;
+            code <<= 1;
+        }
+
+        return false;
+    }
+
+    bool DecodeStoredBlock( void )
+    {
+        // Stored data starts at the next byte.
+        this->bitBuf = 0;
+        this->bitCount = 0;
+
+        if ( this->inSize - this->inPos < 4 )
+        {
+            return false;
+        }
+
+        const unsigned char *lenData = ( this->inData + this->inPos );
+
+        std::uint16_t len = ReadLE16( lenData );
+        std::uint16_t lenComplement = ReadLE16( lenData + 2 );
+
+        if ( len != (std::uint16_t)~lenComplement )
+        {
+            return false;
+        }
+
+        this->inPos += 4;
+
+        if ( this->inSize - this->inPos < len || this->outSize - this->outPos < len )
+        {
+            return false;
+        }
+
+        memcpy( this->outData + this->outPos, this->inData + this->inPos, len );
+
+        this->inPos += len;
+        this->outPos += len;
+
+        return true;
+    }
+
+    bool DecodeCodes( const huffmanTable& lenCodes, const huffmanTable& distCodes )
+    {
+        static const std::uint16_t lenBase[ 29 ] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+        static const std::uint8_t lenExtra[ 29 ] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+        static const std::uint16_t distBase[ 30 ] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+        static const std::uint8_t distExtra[ 30 ] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+        while ( true )
+        {
+            std::uint32_t sym;
+
+            if ( !this->DecodeSymbol( lenCodes, sym ) )
+            {
+                return false;
+            }
+
+            if ( sym < 256 )
+            {
+                if ( this->outPos == this->outSize )
+                {
+                    return false;
+                }
+
+                this->outData[ this->outPos++ ] = (char)sym;
+            }
+            else if ( sym == 256 )
+            {
+                return true;
+            }
+            else
+            {
+                sym -= 257;
+
+                std::uint32_t lenBits, distSym, distBits;
+
+                if ( sym >= 29 || !this->GetBits( lenExtra[ sym ], lenBits ) )
+                {
+                    return false;
+                }
+
+                size_t len = ( lenBase[ sym ] + lenBits );
+
+                if ( !this->DecodeSymbol( distCodes, distSym ) || distSym >= 30 || !this->GetBits( distExtra[ distSym ], distBits ) )
+                {
+                    return false;
+                }
+
+                size_t dist = ( distBase[ distSym ] + distBits );
+
+                if ( dist > this->outPos || this->outSize - this->outPos < len )
+                {
+                    return false;
+                }
+
+                // Source and destination may overlap.
+                char *outPtr = ( this->outData + this->outPos );
+
+                for ( size_t n = 0; n < len; n++ )
+                {
+                    outPtr[ n ] = *( outPtr + n - dist );
+                }
+
+                this->outPos += len;
+            }
+        }
+    }
+
+    bool DecodeFixedBlock( void )
+    {
+        static const struct fixedTables
+        {
+            fixedTables( void )
+            {
+                std::uint8_t codeLengths[ 288 + 30 ];
+
+                std::fill( codeLengths, codeLengths + 144, 8 );
+                std::fill( codeLengths + 144, codeLengths + 256, 9 );
+                std::fill( codeLengths + 256, codeLengths + 280, 7 );
+                std::fill( codeLengths + 280, codeLengths + 288, 8 );
+
+                // Only 30 of the 32 distance codes have a meaning.
+                std::fill( codeLengths + 288, codeLengths + 288 + 30, 5 );
+
+                isValid = (
+                    lenCodes.Construct( codeLengths, 288, false ) &&
+                    distCodes.Construct( codeLengths + 288, 30, true )
+                );
+            }
+
+            huffmanTable lenCodes;
+            huffmanTable distCodes;
+            bool isValid;
+        } tables;
+
+        if ( !tables.isValid )
+        {
+            return false;
+        }
+
+        return this->DecodeCodes( tables.lenCodes, tables.distCodes );
+    }
+
+    bool DecodeDynamicBlock( void )
+    {
+        static const std::uint8_t codeLengthOrder[ 19 ] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+        std::uint32_t numLenCodes, numDistCodes, numCodeLenCodes;
+
+        if ( !this->GetBits( 5, numLenCodes ) || !this->GetBits( 5, numDistCodes ) || !this->GetBits( 4, numCodeLenCodes ) )
+        {
+            return false;
+        }
+
+        numLenCodes += 257;
+        numDistCodes += 1;
+        numCodeLenCodes += 4;
+
+        if ( numLenCodes > 286 || numDistCodes > 30 )
+        {
+            return false;
+        }
+
+        std::uint8_t codeLengths[ 286 + 30 ] = { 0 };
+
+        for ( unsigned int n = 0; n < numCodeLenCodes; n++ )
+        {
+            std::uint32_t len;
+
+            if ( !this->GetBits( 3, len ) )
+            {
+                return false;
+            }
+
+            codeLengths[ codeLengthOrder[ n ] ] = (std::uint8_t)len;
+        }
+
+        huffmanTable lenCodes;
+
+        if ( !lenCodes.Construct( codeLengths, 19, false ) )
+        {
+            return false;
+        }
+
+        // Code lengths of both tables are run-length encoded as one sequence.
+        const unsigned int numCodes = ( numLenCodes + numDistCodes );
+        unsigned int codeIdx = 0;
+
+        while ( codeIdx < numCodes )
+        {
+            std::uint32_t sym;
+
+            if ( !this->DecodeSymbol( lenCodes, sym ) )
+            {
+                return false;
+            }
+
+            if ( sym < 16 )
+            {
+                codeLengths[ codeIdx++ ] = (std::uint8_t)sym;
+                continue;
+            }
+
+            std::uint8_t repeatLen = 0;
+            std::uint32_t repeatCount;
+
+            if ( sym == 16 )
+            {
+                if ( codeIdx == 0 || !this->GetBits( 2, repeatCount ) )
+                {
+                    return false;
+                }
+
+                repeatLen = codeLengths[ codeIdx - 1 ];
+                repeatCount += 3;
+            }
+            else if ( sym == 17 )
+            {
+                if ( !this->GetBits( 3, repeatCount ) )
+                {
+                    return false;
+                }
+
+                repeatCount += 3;
+            }
+            else
+            {
+                if ( !this->GetBits( 7, repeatCount ) )
+                {
+                    return false;
+                }
+
+                repeatCount += 11;
+            }
+
+            if ( codeIdx + repeatCount > numCodes )
+            {
+                return false;
+            }
+
+            std::fill( codeLengths + codeIdx, codeLengths + codeIdx + repeatCount, repeatLen );
+
+            codeIdx += repeatCount;
+        }
+
+        // There has to be an end-of-block code.
+        if ( codeLengths[ 256 ] == 0 )
+        {
+            return false;
+        }
+
+        huffmanTable distCodes;
+
+        if ( !lenCodes.Construct( codeLengths, numLenCodes, true ) ||
+             !distCodes.Construct( codeLengths + numLenCodes, numDistCodes, true ) )
+        {
+            return false;
+        }
+
+        return this->DecodeCodes( lenCodes, distCodes );
+    }
+
+    const unsigned char *inData;
+    size_t inSize;
+    size_t inPos;
+
+    std::uint32_t bitBuf;
+    unsigned int bitCount;
+
+    char *outData;
+    size_t outSize;
+    size_t outPos;
+};
+
+bool ModuleArchive::ReadZipDirectory( std::istream& stream )
+{
+    stream.seekg( 0, std::ios::end );
+
+    std::streamoff fileSize = stream.tellg();
+
+    if ( fileSize < 22 )
+    {
+        return false;
+    }
+
+    // The end of central directory record is followed by a comment of up to 64KB.
+    const std::uint64_t tailSize = std::min <std::uint64_t> ( (std::uint64_t)fileSize, 22 + 0xFFFF );
+    const std::uint64_t tailOffset = ( (std::uint64_t)fileSize - tailSize );
+
+    std::vector <unsigned char> tail( (size_t)tailSize );
+
+    if ( !ReadAt( stream, tailOffset, tail.data(), tail.size() ) )
+    {
+        return false;
+    }
+
+    const unsigned char *endRecord = nullptr;
+
+    for ( size_t off = tail.size() - 22; ; off-- )
+    {
+        if ( ReadLE32( tail.data() + off ) == 0x06054B50 )
+        {
+            endRecord = ( tail.data() + off );
+            break;
+        }
+
+        if ( off == 0 )
+        {
+            return false;
+        }
+    }
+
+    std::uint16_t numEntries = ReadLE16( endRecord + 10 );
+    std::uint32_t dirSize = ReadLE32( endRecord + 12 );
+    std::uint32_t dirOffset = ReadLE32( endRecord + 16 );
+
+    // We do not support zip64 or split archives.
+    if ( numEntries == 0xFFFF || dirOffset == 0xFFFFFFFF || ReadLE16( endRecord + 4 ) != ReadLE16( endRecord + 6 ) )
+    {
+        return false;
+    }
+
+    std::vector <unsigned char> dirData( dirSize );
+
+    if ( !ReadAt( stream, dirOffset, dirData.data(), dirData.size() ) )
+    {
+        return false;
+    }
+
+    size_t dirPos = 0;
+
+    for ( unsigned int n = 0; n < numEntries; n++ )
+    {
+        if ( dirSize - dirPos < 46 )
+        {
+            return false;
+        }
+
+        const unsigned char *entry = ( dirData.data() + dirPos );
+
+        if ( ReadLE32( entry ) != 0x02014B50 )
+        {
+            return false;
+        }
+
+        std::uint16_t nameLen = ReadLE16( entry + 28 );
+        size_t entrySize = ( 46 + nameLen + ReadLE16( entry + 30 ) + ReadLE16( entry + 32 ) );
+
+        if ( dirSize - dirPos < entrySize )
+        {
+            return false;
+        }
+
+        std::string path( (const char*)entry + 46, nameLen );
+
+        // Skip directories.
+        if ( !path.empty() && path.back() != '/' )
+        {
+            member info;
+            info.path = std::move( path );
+            info.dataOffset = ReadLE32( entry + 42 );
+            info.storedSize = ReadLE32( entry + 20 );
+            info.size = ReadLE32( entry + 24 );
+            info.checksum = ReadLE32( entry + 16 );
+
+            // Encrypted members cannot be read.
+            info.method = ( ( ReadLE16( entry + 8 ) & 1 ) != 0 ? 0xFFFF : ReadLE16( entry + 10 ) );
+
+            this->members.push_back( std::move( info ) );
+        }
+
+        dirPos += entrySize;
+    }
+
+    return true;
+}
+
+// Tar numbers are octal text, or big-endian binary if the top bit of the field is set.
+static bool ParseTarNumber( const char *field, size_t fieldSize, std::uint64_t& valueOut )
+{
+    std::uint64_t value = 0;
+
+    if ( ( field[0] & 0x80 ) != 0 )
+    {
+        for ( size_t n = 1; n < fieldSize; n++ )
+        {
+            value = ( ( value << 8 ) | (unsigned char)field[n] );
+        }
+
+        valueOut = value;
+        return true;
+    }
+
+    size_t n = 0;
+
+    while ( n < fieldSize && field[n] == ' ' )
+    {
+        n++;
+    }
+
+    for ( ; n < fieldSize && field[n] != 0 && field[n] != ' '; n++ )
+    {
+        if ( field[n] < '0' || field[n] > '7' )
+        {
+            return false;
+        }
+
+        value = ( ( value << 3 ) | (std::uint64_t)( field[n] - '0' ) );
+    }
+
+    valueOut = value;
+    return true;
+}
+
+// Returns the "path" record of a pax extended header, if there is one.
+static bool FindPaxPath( const std::vector <char>& paxData, std::string& pathOut )
+{
+    size_t pos = 0;
+
+    while ( pos < paxData.size() )
+    {
+        // Each record is "<length> <key>=<value>\n", where the length counts the whole record.
+        size_t recordLen = 0;
+        size_t numPos = pos;
+
+        while ( numPos < paxData.size() && paxData[numPos] >= '0' && paxData[numPos] <= '9' )
+        {
+            recordLen = ( recordLen * 10 + (size_t)( paxData[numPos] - '0' ) );
+            numPos++;
+        }
+
+        if ( numPos == paxData.size() || paxData[numPos] != ' ' || recordLen <= numPos - pos || recordLen > paxData.size() - pos )
+        {
+            return false;
+        }
+
+        const char *keyStart = ( paxData.data() + numPos + 1 );
+        const char *recordEnd = ( paxData.data() + pos + recordLen - 1 );
+
+        if ( recordEnd - keyStart > 5 && memcmp( keyStart, "path=", 5 ) == 0 )
+        {
+            pathOut.assign( keyStart + 5, recordEnd );
+            return true;
+        }
+
+        pos += recordLen;
+    }
+
+    return false;
+}
+
+bool ModuleArchive::ReadTarDirectory( std::istream& stream )
+{
+    std::uint64_t headerOffset = 0;
+
+    // Set by GNU long name and pax headers for the next entry.
+    std::string nextPath;
+
+    while ( true )
+    {
+        char header[ 512 ];
+
+        if ( !ReadAt( stream, headerOffset, header, sizeof(header) ) )
+        {
+            // Some writers leave out the end-of-archive blocks.
+            return ( headerOffset != 0 );
+        }
+
+        if ( std::all_of( header, header + sizeof(header), []( char c ) { return ( c == 0 ); } ) )
+        {
+            break;
+        }
+
+        // The checksum is calculated with the checksum field taken as spaces.
+        std::uint64_t storedChecksum;
+
+        if ( !ParseTarNumber( header + 148, 8, storedChecksum ) )
+        {
+            return false;
+        }
+
+        std::uint64_t checksum = ( 8 * ' ' );
+
+        for ( size_t n = 0; n < sizeof(header); n++ )
+        {
+            if ( n < 148 || n >= 156 )
+            {
+                checksum += (unsigned char)header[n];
+            }
+        }
+
+        std::uint64_t dataSize;
+
+        if ( checksum != storedChecksum || !ParseTarNumber( header + 124, 12, dataSize ) )
+        {
+            return false;
+        }
+
+        const std::uint64_t dataOffset = ( headerOffset + 512 );
+        const char typeFlag = header[ 156 ];
+
+        if ( typeFlag == 'L' || typeFlag == 'x' )
+        {
+            std::vector <char> extData( (size_t)dataSize );
+
+            if ( !ReadAt( stream, dataOffset, extData.data(), extData.size() ) )
+            {
+                return false;
+            }
+
+            if ( typeFlag == 'L' )
+            {
+                nextPath.assign( extData.data(), strnlen( extData.data(), extData.size() ) );
+            }
+            else
+            {
+                FindPaxPath( extData, nextPath );
+            }
+        }
+        else
+        {
+            if ( typeFlag == '0' || typeFlag == 0 || typeFlag == '7' )
+            {
+                std::string path = std::move( nextPath );
+
+                if ( path.empty() )
+                {
+                    path.assign( header, strnlen( header, 100 ) );
+
+                    // ustar splits long paths into a prefix and a name.
+                    if ( memcmp( header + 257, "ustar", 5 ) == 0 && header[ 345 ] != 0 )
+                    {
+                        path = std::string( header + 345, strnlen( header + 345, 155 ) ) + "/" + path;
+                    }
+                }
+
+                member info;
+                info.path = std::move( path );
+                info.dataOffset = dataOffset;
+                info.storedSize = dataSize;
+                info.size = dataSize;
+                info.checksum = 0;
+                info.method = 0;
+
+                this->members.push_back( std::move( info ) );
+            }
+
+            nextPath.clear();
+        }
+
+        headerOffset = ( dataOffset + ( ( dataSize + 511 ) & ~(std::uint64_t)511 ) );
+    }
+
+    return true;
+}
+
+bool ModuleArchive::Open( const char *path )
+{
+    this->archivePath = path;
+    this->members.clear();
+
+    this->isTar = HasExtension( this->archivePath, ".tar" );
+
+    std::ifstream stream( path, std::ios::binary | std::ios::in );
+
+    if ( !stream.good() )
+    {
+        return false;
+    }
+
+    if ( this->isTar )
+    {
+        return this->ReadTarDirectory( stream );
+    }
+
+    return this->ReadZipDirectory( stream );
+}
+
+static bool MatchesPattern( const char *path, const char *pattern )
+{
+    // Position to retry from if the characters after the last '*' do not match.
+    const char *starPattern = nullptr;
+    const char *starPath = nullptr;
+
+    while ( *path != 0 )
+    {
+        if ( *pattern == '*' )
+        {
+            starPattern = ++pattern;
+            starPath = path;
+        }
+        else if ( *pattern == '?' || ( *pattern != 0 && NormalizePathChar( *pattern ) == NormalizePathChar( *path ) ) )
+        {
+            pattern++;
+            path++;
+        }
+        else if ( starPattern != nullptr )
+        {
+            pattern = starPattern;
+            path = ++starPath;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    while ( *pattern == '*' )
+    {
+        pattern++;
+    }
+
+    return ( *pattern == 0 );
+}
+
+void ModuleArchive::FindMembers( const char *pattern, std::vector <size_t>& membersOut ) const
+{
+    size_t firstFound = membersOut.size();
+
+    for ( size_t n = 0; n < this->members.size(); n++ )
+    {
+        if ( MatchesPattern( this->members[ n ].path.c_str(), pattern ) )
+        {
+            membersOut.push_back( n );
+        }
+    }
+
+    std::sort( membersOut.begin() + firstFound, membersOut.end(),
+        [&]( size_t left, size_t right )
+    {
+        return ( this->members[ left ].path < this->members[ right ].path );
+    });
+}
+
+bool ModuleArchive::ExtractMember( size_t memberIdx, std::vector <char>& dataOut ) const
+{
+    const member& info = this->members[ memberIdx ];
+
+    // Every thread uses its own file stream.
+    std::ifstream stream( this->archivePath, std::ios::binary | std::ios::in );
+
+    if ( !stream.good() )
+    {
+        return false;
+    }
+
+    if ( this->isTar )
+    {
+        dataOut.resize( (size_t)info.size );
+
+        return ReadAt( stream, info.dataOffset, dataOut.data(), dataOut.size() );
+    }
+
+    // The local header can have different extra data than the central directory.
+    unsigned char localHeader[ 30 ];
+
+    if ( !ReadAt( stream, info.dataOffset, localHeader, sizeof(localHeader) ) || ReadLE32( localHeader ) != 0x04034B50 )
+    {
+        return false;
+    }
+
+    std::uint64_t dataOffset = ( info.dataOffset + sizeof(localHeader) + ReadLE16( localHeader + 26 ) + ReadLE16( localHeader + 28 ) );
+
+    if ( info.method == 0 )
+    {
+        if ( info.storedSize != info.size )
+        {
+            return false;
+        }
+
+        dataOut.resize( (size_t)info.size );
+
+        if ( !ReadAt( stream, dataOffset, dataOut.data(), dataOut.size() ) )
+        {
+            return false;
+        }
+    }
+    else if ( info.method == 8 )
+    {
+        std::vector <unsigned char> storedData( (size_t)info.storedSize );
+
+        if ( !ReadAt( stream, dataOffset, storedData.data(), storedData.size() ) )
+        {
+            return false;
+        }
+
+        dataOut.resize( (size_t)info.size );
+
+        inflateDecoder decoder( storedData.data(), storedData.size(), dataOut.data(), dataOut.size() );
+
+        if ( !decoder.Decode() )
+        {
+            return false;
+        }
+    }
+    else
+    {
+        return false;
+    }
+
+    return ( CalculateCRC32( dataOut.data(), dataOut.size() ) == info.checksum );
+}
+
+bool SplitArchiveModulePath( const char *arg, std::string& archivePathOut, std::string& memberPatternOut )
+{
+    std::string argStr( arg );
+
+    // Colons can also be part of drive letters, so we look for one that follows an archive name.
+    size_t colonPos = argStr.find( ':' );
+
+    while ( colonPos != std::string::npos )
+    {
+        std::string archivePath = argStr.substr( 0, colonPos );
+
+        if ( ( HasExtension( archivePath, ".zip" ) || HasExtension( archivePath, ".tar" ) ) && colonPos + 1 < argStr.size() )
+        {
+            archivePathOut = std::move( archivePath );
+            memberPatternOut = argStr.substr( colonPos + 1 );
+            return true;
+        }
+
+        colonPos = argStr.find( ':', colonPos + 1 );
+    }
+
+    return false;
+}
@@ -0,0 +1,52 @@
+#ifndef _MODULE_ARCHIVE_
+#define _MODULE_ARCHIVE_
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// Zip or tar file that module images are read from without extracting them to disk first.
+// Zip members have to be stored or deflated; tar files must not be compressed.
+// Only the directory is read when opening, member data is read on demand.
+struct ModuleArchive
+{
+    // The format is chosen by the file extension (".tar" or else zip).
+    bool Open( const char *path );
+
+    // Appends the members whose path matches a pattern, sorted by path. '*' matches any
+    // amount of characters (including slashes) and '?' matches one character. Matching
+    // ignores case and does not tell slashes and backslashes apart.
+    void FindMembers( const char *pattern, std::vector <size_t>& membersOut ) const;
+
+    inline const std::string& GetMemberPath( size_t memberIdx ) const     { return this->members[ memberIdx ].path; }
+
+    // Reads and decompresses the data of a member. Can be called by multiple threads at once.
+    bool ExtractMember( size_t memberIdx, std::vector <char>& dataOut ) const;
+
+private:
+    bool ReadZipDirectory( std::istream& stream );
+    bool ReadTarDirectory( std::istream& stream );
+
+    struct member
+    {
+        std::string path;
+        std::uint64_t dataOffset;       // zip: offset of the local file header
+        std::uint64_t storedSize;
+        std::uint64_t size;
+        std::uint32_t checksum;         // zip only (CRC-32)
+        std::uint16_t method;           // zip only
+    };
+
+    std::string archivePath;
+    bool isTar = false;
+
+    std::vector <member> members;
+};
+
+// Splits a module argument of the form "archive.zip:member" or "archive.tar:member".
+// Returns false if the argument does not refer to an archive.
+bool SplitArchiveModulePath( const char *arg, std::string& archivePathOut, std::string& memberPatternOut );
+
+#endif //_MODULE_ARCHIVE_
@@ -0,0 +1,152 @@
+#include "modmanifest.h"
+
+#include <fstream>
+
+struct moduleOptionName
+{
+    const char *name;
+    bool ModuleEmbedOptions::*field;
+    bool value;
+};
+
+// The names that the command line had for these options are kept; the others turn
+// an option of the command line off again for a module.
+static const moduleOptionName moduleOptionNames[] =
+{
+    { "injimp", &ModuleEmbedOptions::injectMatchingImports, true },
+    { "impinj", &ModuleEmbedOptions::injectMatchingImports, true },
+    { "noinjimp", &ModuleEmbedOptions::injectMatchingImports, false },
+    { "noimpinj", &ModuleEmbedOptions::injectMatchingImports, false },
+    { "noexp", &ModuleEmbedOptions::takeoverExports, false },
+    { "exp", &ModuleEmbedOptions::takeoverExports, true },
+    { "nores", &ModuleEmbedOptions::ignoreResources, true },
+    { "ignres", &ModuleEmbedOptions::ignoreResources, true },
+    { "res", &ModuleEmbedOptions::ignoreResources, false },
+    { "noentryexecfix", &ModuleEmbedOptions::fixEntrypointExecutable, false },
+    { "noeexecfix", &ModuleEmbedOptions::fixEntrypointExecutable, false },
+    { "entryexecfix", &ModuleEmbedOptions::fixEntrypointExecutable, true },
+    { "marksectexec", &ModuleEmbedOptions::markAllSectionsExecutable, true },
+    { "nomarksectexec", &ModuleEmbedOptions::markAllSectionsExecutable, false },
+    { "stripimp", &ModuleEmbedOptions::stripUnusedImports, true },
+    { "nostripimp", &ModuleEmbedOptions::stripUnusedImports, false },
+    { "noarenacache", &ModuleEmbedOptions::useArenaCache, false }
+};
+
+bool ApplyModuleOption( const std::string& opt, ModuleEmbedOptions& options )
+{
+    for ( const moduleOptionName& optName : moduleOptionNames )
+    {
+        if ( opt == optName.name )
+        {
+            options.*optName.field = optName.value;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Splits a manifest line into tokens. Returns false if a quote is not closed.
+static bool SplitManifestLine( const std::string& line, std::vector <std::string>& tokensOut )
+{
+    size_t lineLen = line.size();
+    size_t pos = 0;
+
+    while ( true )
+    {
+        while ( pos < lineLen && ( line[ pos ] == ' ' || line[ pos ] == '\t' || line[ pos ] == '\r' ) )
+        {
+            pos++;
+        }
+
+        if ( pos == lineLen || line[ pos ] == '#' )
+        {
+            return true;
+        }
+
+        if ( line[ pos ] == '"' )
+        {
+            size_t quoteEnd = line.find( '"', pos + 1 );
+
+            if ( quoteEnd == std::string::npos )
+            {
+                return false;
+            }
+
+            tokensOut.push_back( line.substr( pos + 1, quoteEnd - ( pos + 1 ) ) );
+
+            pos = ( quoteEnd + 1 );
+        }
+        else
+        {
+            size_t tokenStart = pos;
+
+            while ( pos < lineLen && line[ pos ] != ' ' && line[ pos ] != '\t' && line[ pos ] != '\r' )
+            {
+                pos++;
+            }
+
+            tokensOut.push_back( line.substr( tokenStart, pos - tokenStart ) );
+        }
+    }
+}
+
+bool ModuleManifest::Load( const char *path, const ModuleEmbedOptions& defaultOptions )
+{
+    this->errorLine = 0;
+
+    std::ifstream manifestStream( path );
+
+    if ( !manifestStream.good() )
+    {
+        return false;
+    }
+
+    std::string line;
+    size_t lineNum = 0;
+
+    std::vector <std::string> tokens;
+
+    while ( std::getline( manifestStream, line ) )
+    {
+        lineNum++;
+
+        tokens.clear();
+
+        if ( !SplitManifestLine( line, tokens ) )
+        {
+            this->errorLine = lineNum;
+            return false;
+        }
+
+        if ( tokens.empty() )
+        {
+            continue;
+        }
+
+        entry item;
+        item.path = std::move( tokens[ 0 ] );
+        item.options = defaultOptions;
+
+        if ( item.path.empty() )
+        {
+            this->errorLine = lineNum;
+            return false;
+        }
+
+        for ( size_t n = 1; n < tokens.size(); n++ )
+        {
+            const std::string& optToken = tokens[ n ];
+
+            if ( optToken.size() < 2 || optToken[ 0 ] != '-' || !ApplyModuleOption( optToken.substr( 1 ), item.options ) )
+            {
+                this->errorLine = lineNum;
+                return false;
+            }
+        }
+
+        this->entries.push_back( std::move( item ) );
+    }
+
+    return true;
+}
@@ -0,0 +1,48 @@
+#ifndef _MODULE_MANIFEST_
+#define _MODULE_MANIFEST_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Settings of the embedding that can differ from module to module. The command line
+// sets them for all modules; a module manifest can change them for each module.
+struct ModuleEmbedOptions
+{
+    bool injectMatchingImports = false;
+    bool takeoverExports = true;
+    bool ignoreResources = false;
+    bool fixEntrypointExecutable = true;
+    bool markAllSectionsExecutable = false;
+    bool stripUnusedImports = false;
+    bool useArenaCache = true;
+};
+
+// Sets a module option by its name (without the '-'). Returns false if it is no module option.
+bool ApplyModuleOption( const std::string& opt, ModuleEmbedOptions& options );
+
+// List of modules to embed, one per line, each followed by its options:
+//
+//   scripts/heavy.asi -nores -stripimp
+//   "mods/with spaces.asi" -impinj
+//   mods.zip:*.asi -noexp
+//
+// Every module starts out with the options of the command line. Paths can be quoted and
+// can refer to archive members; a token that starts with '#' starts a comment.
+struct ModuleManifest
+{
+    // Returns false if the file cannot be read (errorLine is 0) or if a line is invalid.
+    bool Load( const char *path, const ModuleEmbedOptions& defaultOptions );
+
+    struct entry
+    {
+        std::string path;
+        ModuleEmbedOptions options;
+    };
+
+    std::vector <entry> entries;
+
+    size_t errorLine = 0;
+};
+
+#endif //_MODULE_MANIFEST_
@@ -86,4 +86,25 @@ std::string OptionParser::FetchOption( void )
     this->curArgPtr = argPtr;
 
     return optString;
-}
\ No newline at end of file
+}
+
+const char* OptionParser::FetchValue( void )
+{
+    // Takes the entire next argument as value of the previously fetched option.
+    size_t argIdx = this->curArg;
+    size_t numArgs = this->numArgs;
+
+    if ( argIdx >= numArgs )
+    {
+        return nullptr;
+    }
+
+    const char *valuePtr = this->curArgPtr;
+
+    argIdx++;
+
+    this->curArg = argIdx;
+    this->curArgPtr = UpdateArgPtr( argIdx, numArgs );
+
+    return valuePtr;
+}
@@ -0,0 +1,134 @@
+#include "prefetchstream.h"
+
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <algorithm>
+
+PEStreamPrefetch::PEStreamPrefetch( const char *path )
+{
+    this->readSuccess = false;
+    this->seekPtr = 0;
+
+    this->readerThread = std::thread( ReaderThreadProc, this, std::string( path ) );
+}
+
+PEStreamPrefetch::PEStreamPrefetch( std::shared_ptr <const ModuleArchive> archive, size_t memberIdx )
+{
+    this->readSuccess = false;
+    this->seekPtr = 0;
+
+    this->readerThread = std::thread( ArchiveReaderThreadProc, this, std::move( archive ), memberIdx );
+}
+
+PEStreamPrefetch::~PEStreamPrefetch( void )
+{
+    // The thread accesses our members so it must finish first.
+    if ( this->readerThread.joinable() )
+    {
+        this->readerThread.join();
+    }
+}
+
+void PEStreamPrefetch::ReaderThreadProc( PEStreamPrefetch *stream, std::string path )
+{
+    try
+    {
+        std::ifstream fileStream( path, std::ios::binary | std::ios::in | std::ios::ate );
+
+        if ( !fileStream.good() )
+        {
+            return;
+        }
+
+        std::streamoff fileSize = fileStream.tellg();
+
+        if ( fileSize < 0 )
+        {
+            return;
+        }
+
+        fileStream.seekg( 0 );
+
+        stream->fileData.resize( (size_t)fileSize );
+
+        fileStream.read( stream->fileData.data(), fileSize );
+
+        stream->readSuccess = ( fileStream.gcount() == fileSize );
+    }
+    catch( ... )
+    {
+        // Reported as read failure.
+        stream->readSuccess = false;
+    }
+}
+
+void PEStreamPrefetch::ArchiveReaderThreadProc( PEStreamPrefetch *stream, std::shared_ptr <const ModuleArchive> archive, size_t memberIdx )
+{
+    try
+    {
+        stream->readSuccess = archive->ExtractMember( memberIdx, stream->fileData );
+    }
+    catch( ... )
+    {
+        // Reported as read failure.
+        stream->readSuccess = false;
+    }
+}
+
+bool PEStreamPrefetch::WaitForData( void )
+{
+    if ( this->readerThread.joinable() )
+    {
+        this->readerThread.join();
+    }
+
+    return this->readSuccess;
+}
+
+size_t PEStreamPrefetch::Read( void *buf, size_t readCount )
+{
+    if ( !this->WaitForData() )
+    {
+        return 0;
+    }
+
+    pe_file_ptr_t seekPtr = this->seekPtr;
+    pe_file_ptr_t fileSize = (pe_file_ptr_t)this->fileData.size();
+
+    if ( seekPtr < 0 || seekPtr >= fileSize )
+    {
+        return 0;
+    }
+
+    size_t canRead = std::min( readCount, (size_t)( fileSize - seekPtr ) );
+
+    memcpy( buf, this->fileData.data() + seekPtr, canRead );
+
+    this->seekPtr = ( seekPtr + (pe_file_ptr_t)canRead );
+
+    return canRead;
+}
+
+bool PEStreamPrefetch::Write( const void*, size_t )
+{
+    // Input images are read-only.
+    return false;
+}
+
+bool PEStreamPrefetch::Seek( pe_file_ptr_t ptr )
+{
+    if ( ptr < 0 )
+    {
+        return false;
+    }
+
+    this->seekPtr = ptr;
+
+    return true;
+}
+
+pe_file_ptr_t PEStreamPrefetch::Tell( void ) const
+{
+    return this->seekPtr;
+}
@@ -0,0 +1,48 @@
+#ifndef _PREFETCH_STREAM_
+#define _PREFETCH_STREAM_
+
+#include <peframework.h>
+
+#include "modarchive.h"
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Read-only PEStream whose file contents are loaded by a background thread.
+// This way disk reads of upcoming module images overlap with the embedding work.
+// PE loading seeks all over the file, so the entire file is prefetched into memory.
+// Modules inside of archives are decompressed by the background thread instead.
+struct PEStreamPrefetch : public PEStream
+{
+    PEStreamPrefetch( const char *path );
+    PEStreamPrefetch( std::shared_ptr <const ModuleArchive> archive, size_t memberIdx );
+    ~PEStreamPrefetch( void );
+
+    // Blocks until the file has been read; returns false if it could not be read.
+    bool WaitForData( void );
+
+    // Contents of the entire file; only valid after WaitForData.
+    inline const void* GetData( void ) const       { return this->fileData.data(); }
+    inline size_t GetDataSize( void ) const         { return this->fileData.size(); }
+
+    size_t Read( void *buf, size_t readCount ) override;
+    bool Write( const void *buf, size_t writeCount ) override;
+    bool Seek( pe_file_ptr_t ptr ) override;
+    pe_file_ptr_t Tell( void ) const override;
+
+private:
+    static void ReaderThreadProc( PEStreamPrefetch *stream, std::string path );
+    static void ArchiveReaderThreadProc( PEStreamPrefetch *stream, std::shared_ptr <const ModuleArchive> archive, size_t memberIdx );
+
+    std::thread readerThread;
+
+    // Only valid after WaitForData.
+    std::vector <char> fileData;
+    bool readSuccess;
+
+    pe_file_ptr_t seekPtr;
+};
+
+#endif //_PREFETCH_STREAM_
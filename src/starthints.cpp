@@ -0,0 +1,199 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "starthints.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#define STARTUP_PAGE_SIZE   0x1000
+
+static bool EqualsModuleName( const std::string& left, const char *right )
+{
+    size_t rightLen = strlen( right );
+
+    if ( left.size() != rightLen )
+    {
+        return false;
+    }
+
+    for ( size_t n = 0; n < rightLen; n++ )
+    {
+        if ( tolower( (unsigned char)left[ n ] ) != tolower( (unsigned char)right[ n ] ) )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool StartupPageHints::LoadRVAList( const char *path )
+{
+    std::ifstream listStream( path );
+
+    if ( !listStream.good() )
+    {
+        return false;
+    }
+
+    std::string line;
+
+    while ( std::getline( listStream, line ) )
+    {
+        size_t commentPos = line.find( '#' );
+
+        if ( commentPos != std::string::npos )
+        {
+            line.resize( commentPos );
+        }
+
+        std::istringstream lineStream( line );
+
+        std::string firstToken, secondToken;
+        lineStream >> firstToken >> secondToken;
+
+        if ( firstToken.empty() )
+        {
+            continue;
+        }
+
+        listedRVA item;
+
+        const std::string *rvaToken = &firstToken;
+
+        if ( !secondToken.empty() )
+        {
+            item.moduleName = std::move( firstToken );
+            rvaToken = &secondToken;
+        }
+
+        char *rvaEnd;
+        unsigned long rva = strtoul( rvaToken->c_str(), &rvaEnd, 16 );
+
+        if ( *rvaEnd != '\0' )
+        {
+            return false;
+        }
+
+        item.rva = (std::uint32_t)rva;
+
+        if ( item.moduleName.empty() )
+        {
+            this->AddRange( item.rva, 1 );
+        }
+        else
+        {
+            this->listedRVAs.push_back( std::move( item ) );
+        }
+    }
+
+    return true;
+}
+
+void StartupPageHints::AddModule( const char *moduleName, std::uint32_t arenaRVA, std::uint32_t arenaSize )
+{
+    for ( const listedRVA& item : this->listedRVAs )
+    {
+        if ( item.rva < arenaSize && EqualsModuleName( item.moduleName, moduleName ) )
+        {
+            this->AddRange( arenaRVA + item.rva, 1 );
+        }
+    }
+}
+
+void StartupPageHints::AddRange( std::uint32_t rva, std::uint32_t size )
+{
+    if ( size == 0 )
+    {
+        return;
+    }
+
+    std::uint32_t firstPage = ( rva / STARTUP_PAGE_SIZE );
+    std::uint32_t lastPage = (std::uint32_t)( ( (std::uint64_t)rva + size - 1 ) / STARTUP_PAGE_SIZE );
+
+    for ( std::uint32_t page = firstPage; page <= lastPage; page++ )
+    {
+        this->hotPages.push_back( page );
+    }
+}
+
+bool StartupPageHints::WriteToFile( const char *path, const char *imageName, PEFile& image ) const
+{
+    std::ofstream hintStream( path, std::ios::out | std::ios::trunc );
+
+    if ( !hintStream.good() )
+    {
+        return false;
+    }
+
+    std::vector <std::uint32_t> pages = this->hotPages;
+
+    std::sort( pages.begin(), pages.end() );
+    pages.erase( std::unique( pages.begin(), pages.end() ), pages.end() );
+
+    char lineBuf[ 128 ];
+
+    hintStream << " " << imageName << std::endl << std::endl;
+
+    // Neighbouring pages are merged so that the list can be handed to PrefetchVirtualMemory
+    // after adding the image base to each address.
+    hintStream << " Prefetch ranges" << std::endl << std::endl;
+    hintStream << "  Rva       NumberOfBytes" << std::endl << std::endl;
+
+    size_t pageIdx = 0;
+    size_t numRanges = 0;
+
+    while ( pageIdx < pages.size() )
+    {
+        std::uint32_t firstPage = pages[ pageIdx ];
+        std::uint32_t numPages = 1;
+
+        while ( pageIdx + numPages < pages.size() && pages[ pageIdx + numPages ] == firstPage + numPages )
+        {
+            numPages++;
+        }
+
+        snprintf( lineBuf, sizeof(lineBuf), "  %08x  %08x", firstPage * STARTUP_PAGE_SIZE, numPages * STARTUP_PAGE_SIZE );
+        hintStream << lineBuf << std::endl;
+
+        pageIdx += numPages;
+        numRanges++;
+    }
+
+    hintStream << std::endl << " " << numRanges << " ranges, " << pages.size() << " pages" << std::endl << std::endl;
+
+    // List how much of each section is touched.
+    hintStream << " Sections" << std::endl << std::endl;
+    hintStream << "  Name      Rva       Pages  Hot    Startup" << std::endl << std::endl;
+
+    PEFile::sectionIter_t iter = image.GetSectionIterator();
+
+    for ( ; !iter.IsEnd(); iter.Increment() )
+    {
+        PEFile::PESection *sect = iter.Resolve();
+
+        std::uint32_t sectRVA = sect->GetVirtualAddress();
+        std::uint32_t sectSize = sect->GetVirtualSize();
+
+        std::uint32_t firstPage = ( sectRVA / STARTUP_PAGE_SIZE );
+        std::uint32_t endPage = (std::uint32_t)( ( (std::uint64_t)sectRVA + sectSize + STARTUP_PAGE_SIZE - 1 ) / STARTUP_PAGE_SIZE );
+
+        auto hotBegin = std::lower_bound( pages.begin(), pages.end(), firstPage );
+        auto hotEnd = std::lower_bound( hotBegin, pages.end(), endPage );
+
+        size_t numHotPages = (size_t)( hotEnd - hotBegin );
+
+        snprintf( lineBuf, sizeof(lineBuf), "  %-8s  %08x  %5u  %5u  %s",
+            sect->shortName.GetConstString(), sectRVA, endPage - firstPage, (unsigned int)numHotPages,
+            ( numHotPages == 0 ) ? "cold" : "hot"
+        );
+        hintStream << lineBuf << std::endl;
+    }
+
+    return hintStream.good();
+}
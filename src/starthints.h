@@ -0,0 +1,41 @@
+#ifndef _STARTUP_PAGE_HINTS_
+#define _STARTUP_PAGE_HINTS_
+
+#include <peframework.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Pages of the output image that are touched while the entry stub and the module
+// initializers run. The result is a list of page ranges in the shape of
+// WIN32_MEMORY_RANGE_ENTRY (for PrefetchVirtualMemory) and a report of sections
+// that are cold during startup.
+struct StartupPageHints
+{
+    // Reads a list of additional init-time RVAs. Each line is either "<rva>" for an RVA
+    // of the output image or "<module file name> <rva>" for an RVA inside of a module.
+    // RVAs are hexadecimal; '#' starts a comment.
+    bool LoadRVAList( const char *path );
+
+    // Called once a module has been placed, so that listed module RVAs can be translated.
+    void AddModule( const char *moduleName, std::uint32_t arenaRVA, std::uint32_t arenaSize );
+
+    void AddRange( std::uint32_t rva, std::uint32_t size );
+
+    bool WriteToFile( const char *path, const char *imageName, PEFile& image ) const;
+
+private:
+    struct listedRVA
+    {
+        std::string moduleName;     // empty if the RVA is for the output image
+        std::uint32_t rva;
+    };
+
+    std::vector <listedRVA> listedRVAs;
+
+    // Indices of touched pages; may contain duplicates until written.
+    std::vector <std::uint32_t> hotPages;
+};
+
+#endif //_STARTUP_PAGE_HINTS_
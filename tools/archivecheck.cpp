@@ -0,0 +1,54 @@
+// Extracts every member of the given module archives and fails if one of them cannot
+// be read. Zip members are checked against their CRC-32 while extracting, so this
+// covers the inflate decoder for stored, fixed and dynamic Huffman blocks.
+//
+//   archivecheck ../tools/data/deflated.zip ../tools/data/fixed.zip
+
+#include "../src/modarchive.h"
+
+#include <iostream>
+
+int main( int argc, char *argv[] )
+{
+    int numFailed = 0;
+
+    for ( int argIdx = 1; argIdx < argc; argIdx++ )
+    {
+        const char *archivePath = argv[ argIdx ];
+
+        ModuleArchive archive;
+
+        if ( !archive.Open( archivePath ) )
+        {
+            std::cout << archivePath << ": failed to open" << '\n';
+
+            numFailed++;
+            continue;
+        }
+
+        std::vector <size_t> members;
+        archive.FindMembers( "*", members );
+
+        for ( size_t memberIdx : members )
+        {
+            std::vector <char> memberData;
+
+            bool couldExtract = archive.ExtractMember( memberIdx, memberData );
+
+            std::cout << archivePath << ": " << archive.GetMemberPath( memberIdx ) << " (" << memberData.size() << " bytes) " << ( couldExtract ? "ok" : "FAILED" ) << '\n';
+
+            if ( !couldExtract )
+            {
+                numFailed++;
+            }
+        }
+    }
+
+    if ( numFailed != 0 )
+    {
+        std::cout << numFailed << " failed" << '\n';
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,576 @@
+// Micro-benchmark of the eirrepo containers that peframework is built on, next to their std
+// counterparts, on PE-shaped workloads. Prints one JSON object per line:
+//
+//   {"bench":"reloc_push_back","impl":"std","items":20000,"ns_per_item":2.10,"best_ms":0.04}
+//
+// Every case is run a few times and the fastest run is reported. Compare runs with the same
+// item count only; some containers do not scale linearly.
+//
+//   containerbench [items]
+
+#include <peframework.h>
+
+#include <sdk/AVLTree.h>
+#include <sdk/MemoryUtils.stream.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <list>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+static const unsigned int NUM_RUNS = 5;
+
+// Keeps the compiler from optimizing the measured work away.
+static volatile std::uint64_t benchSink = 0;
+
+// The setup callback runs before every run and is not timed.
+template <typename setupCallbackType, typename callbackType>
+static void RunBench( const char *benchName, const char *implName, size_t numItems, const setupCallbackType& setupCB, const callbackType& cb )
+{
+    double bestMS = 0;
+
+    for ( unsigned int runIdx = 0; runIdx < NUM_RUNS; runIdx++ )
+    {
+        setupCB();
+
+        auto startTime = std::chrono::steady_clock::now();
+
+        benchSink = ( benchSink + cb() );
+
+        double runMS = std::chrono::duration <double, std::milli> ( std::chrono::steady_clock::now() - startTime ).count();
+
+        if ( runIdx == 0 || runMS < bestMS )
+        {
+            bestMS = runMS;
+        }
+    }
+
+    printf( "{\"bench\":\"%s\",\"impl\":\"%s\",\"items\":%zu,\"ns_per_item\":%.3f,\"best_ms\":%.3f}\n",
+        benchName, implName, numItems, ( bestMS * 1000000.0 ) / (double)numItems, bestMS
+    );
+}
+
+template <typename callbackType>
+static void RunBench( const char *benchName, const char *implName, size_t numItems, const callbackType& cb )
+{
+    RunBench( benchName, implName, numItems, []{}, cb );
+}
+
+// Same layout as a base relocation entry.
+struct relocItem
+{
+    std::uint16_t offset : 12;
+    std::uint16_t type : 4;
+};
+
+struct rvaTreeNode
+{
+    std::uint32_t rva;
+    AVLNode node;
+};
+
+struct rvaTreeDispatcher
+{
+    static inline eir::eCompResult CompareNodes( const AVLNode *left, const AVLNode *right )
+    {
+        return eir::DefaultValueCompare( AVL_GETITEM( rvaTreeNode, left, node )->rva, AVL_GETITEM( rvaTreeNode, right, node )->rva );
+    }
+
+    static inline eir::eCompResult CompareNodeWithValue( const AVLNode *left, std::uint32_t right )
+    {
+        return eir::DefaultValueCompare( AVL_GETITEM( rvaTreeNode, left, node )->rva, right );
+    }
+};
+
+struct listItem
+{
+    std::uint32_t rva;
+    RwListEntry <listItem> node;
+};
+
+int main( int argc, char *argv[] )
+{
+    size_t numItems = 20000;
+
+    if ( argc >= 2 )
+    {
+        numItems = (size_t)strtoull( argv[1], nullptr, 10 );
+
+        if ( numItems == 0 )
+        {
+            fprintf( stderr, "invalid item count: %s\n", argv[1] );
+            return 1;
+        }
+    }
+
+    // Export names and RVAs in the order that a loader would see them.
+    std::mt19937 rng( 1 );
+
+    std::vector <std::string> names( numItems );
+    std::vector <std::uint32_t> rvas( numItems );
+
+    for ( size_t n = 0; n < numItems; n++ )
+    {
+        names[ n ] = ( "ExportedFunction_" + std::to_string( n ) );
+        rvas[ n ] = (std::uint32_t)( 0x1000 + n * 16 );
+    }
+
+    std::shuffle( names.begin(), names.end(), rng );
+    std::shuffle( rvas.begin(), rvas.end(), rng );
+
+    // Push-back of relocation items, one at a time like the relocation parser does.
+    RunBench( "reloc_push_back", "eir", numItems, [&]
+    {
+        peVector <relocItem> items;
+
+        for ( size_t n = 0; n < numItems; n++ )
+        {
+            relocItem item;
+            item.offset = (std::uint16_t)( n & 0xFFF );
+            item.type = 3;
+
+            items.AddToBack( item );
+        }
+
+        return (std::uint64_t)items.GetCount();
+    });
+    RunBench( "reloc_push_back", "std", numItems, [&]
+    {
+        std::vector <relocItem> items;
+
+        for ( size_t n = 0; n < numItems; n++ )
+        {
+            relocItem item;
+            item.offset = (std::uint16_t)( n & 0xFFF );
+            item.type = 3;
+
+            items.push_back( item );
+        }
+
+        return (std::uint64_t)items.size();
+    });
+
+    // Iteration over the relocation items.
+    {
+        peVector <relocItem> eirItems;
+        std::vector <relocItem> stdItems;
+
+        for ( size_t n = 0; n < numItems; n++ )
+        {
+            relocItem item;
+            item.offset = (std::uint16_t)( n & 0xFFF );
+            item.type = 3;
+
+            eirItems.AddToBack( item );
+            stdItems.push_back( item );
+        }
+
+        RunBench( "reloc_iterate", "eir", numItems, [&]
+        {
+            std::uint64_t sum = 0;
+
+            for ( const relocItem& item : eirItems )
+            {
+                sum += item.offset;
+            }
+
+            return sum;
+        });
+        RunBench( "reloc_iterate", "std", numItems, [&]
+        {
+            std::uint64_t sum = 0;
+
+            for ( const relocItem& item : stdItems )
+            {
+                sum += item.offset;
+            }
+
+            return sum;
+        });
+    }
+
+    // Sorted insert of export names, lookup and in-order iteration, with the key type of the
+    // export name map.
+    {
+        std::vector <peString <char>> eirNames;
+        eirNames.reserve( numItems );
+
+        for ( const std::string& name : names )
+        {
+            eirNames.emplace_back( name.c_str(), name.size() );
+        }
+
+        peMap <PEFile::PEExportDir::mappedName, size_t> eirMap;
+        std::map <std::string, size_t> stdMap;
+
+        RunBench( "export_name_insert", "eir", numItems, [&]
+        {
+            eirMap.Clear();
+
+            for ( size_t n = 0; n < numItems; n++ )
+            {
+                PEFile::PEExportDir::mappedName nameKey;
+                nameKey.name = eirNames[ n ];
+
+                eirMap.Set( std::move( nameKey ), n );
+            }
+
+            return (std::uint64_t)eirMap.GetKeyValueCount();
+        });
+        RunBench( "export_name_insert", "std", numItems, [&]
+        {
+            stdMap.clear();
+
+            for ( size_t n = 0; n < numItems; n++ )
+            {
+                stdMap[ names[ n ] ] = n;
+            }
+
+            return (std::uint64_t)stdMap.size();
+        });
+
+        RunBench( "export_name_lookup", "eir", numItems, [&]
+        {
+            std::uint64_t sum = 0;
+
+            for ( size_t n = 0; n < numItems; n++ )
+            {
+                sum += eirMap.Find( eirNames[ n ] )->GetValue();
+            }
+
+            return sum;
+        });
+        RunBench( "export_name_lookup", "std", numItems, [&]
+        {
+            std::uint64_t sum = 0;
+
+            for ( size_t n = 0; n < numItems; n++ )
+            {
+                sum += stdMap.find( names[ n ] )->second;
+            }
+
+            return sum;
+        });
+
+        RunBench( "export_name_iterate", "eir", numItems, [&]
+        {
+            std::uint64_t sum = 0;
+
+            for ( auto *node : eirMap )
+            {
+                sum += node->GetValue();
+            }
+
+            return sum;
+        });
+        RunBench( "export_name_iterate", "std", numItems, [&]
+        {
+            std::uint64_t sum = 0;
+
+            for ( const auto& pair : stdMap )
+            {
+                sum += pair.second;
+            }
+
+            return sum;
+        });
+
+        // Neighbouring names share a long prefix, like the names of one DLL do.
+        RunBench( "string_compare", "eir", numItems, [&]
+        {
+            std::uint64_t numEqual = 0;
+
+            for ( size_t n = 1; n < numItems; n++ )
+            {
+                numEqual += ( eirNames[ n ] == eirNames[ n - 1 ] );
+                numEqual += ( eirNames[ n ] == eirNames[ n ] );
+            }
+
+            return numEqual;
+        });
+        RunBench( "string_compare", "std", numItems, [&]
+        {
+            std::uint64_t numEqual = 0;
+
+            for ( size_t n = 1; n < numItems; n++ )
+            {
+                numEqual += ( names[ n ] == names[ n - 1 ] );
+                numEqual += ( names[ n ] == names[ n ] );
+            }
+
+            return numEqual;
+        });
+    }
+
+    // Sets of RVAs, as used for relocation targets and referenced sections.
+    {
+        peSet <std::uint32_t, eir::SetDefaultComparator> eirSet;
+        std::set <std::uint32_t> stdSet;
+
+        RunBench( "rva_set_insert", "eir", numItems, [&]
+        {
+            eirSet.Clear();
+
+            for ( std::uint32_t rva : rvas )
+            {
+                eirSet.Insert( rva );
+            }
+
+            return (std::uint64_t)eirSet.GetValueCount();
+        });
+        RunBench( "rva_set_insert", "std", numItems, [&]
+        {
+            stdSet.clear();
+
+            for ( std::uint32_t rva : rvas )
+            {
+                stdSet.insert( rva );
+            }
+
+            return (std::uint64_t)stdSet.size();
+        });
+
+        RunBench( "rva_set_lookup", "eir", numItems, [&]
+        {
+            std::uint64_t numFound = 0;
+
+            for ( std::uint32_t rva : rvas )
+            {
+                numFound += ( eirSet.Find( rva ) != nullptr );
+            }
+
+            return numFound;
+        });
+        RunBench( "rva_set_lookup", "std", numItems, [&]
+        {
+            std::uint64_t numFound = 0;
+
+            for ( std::uint32_t rva : rvas )
+            {
+                numFound += ( stdSet.find( rva ) != stdSet.end() );
+            }
+
+            return numFound;
+        });
+    }
+
+    // Intrusive AVL tree of RVA nodes, the way the section allocation maps work.
+    {
+        std::vector <rvaTreeNode> treeNodes( numItems );
+
+        for ( size_t n = 0; n < numItems; n++ )
+        {
+            treeNodes[ n ].rva = rvas[ n ];
+        }
+
+        AVLTree <rvaTreeDispatcher> tree;
+
+        RunBench( "avltree_insert_lookup", "eir", numItems, [&]
+        {
+            tree.Clear();
+
+            for ( rvaTreeNode& treeNode : treeNodes )
+            {
+                tree.Insert( &treeNode.node );
+            }
+
+            std::uint64_t numFound = 0;
+
+            for ( std::uint32_t rva : rvas )
+            {
+                numFound += ( tree.FindNode( rva ) != nullptr );
+            }
+
+            return numFound;
+        });
+        RunBench( "avltree_insert_lookup", "std", numItems, [&]
+        {
+            std::set <std::uint32_t> stdTree;
+
+            for ( std::uint32_t rva : rvas )
+            {
+                stdTree.insert( rva );
+            }
+
+            std::uint64_t numFound = 0;
+
+            for ( std::uint32_t rva : rvas )
+            {
+                numFound += ( stdTree.find( rva ) != stdTree.end() );
+            }
+
+            return numFound;
+        });
+
+        tree.Clear();
+    }
+
+    // Intrusive list of nodes, the way sections and import descriptors are kept.
+    {
+        std::vector <listItem> listItems( numItems );
+
+        for ( size_t n = 0; n < numItems; n++ )
+        {
+            listItems[ n ].rva = rvas[ n ];
+        }
+
+        RunBench( "list_append_iterate", "eir", numItems, [&]
+        {
+            RwList <listItem> list;
+
+            for ( listItem& item : listItems )
+            {
+                LIST_APPEND( list.root, item.node );
+            }
+
+            std::uint64_t sum = 0;
+
+            LIST_FOREACH_BEGIN( listItem, list.root, node )
+
+                sum += item->rva;
+
+            LIST_FOREACH_END
+
+            LIST_CLEAR( list.root );
+
+            return sum;
+        });
+        RunBench( "list_append_iterate", "std", numItems, [&]
+        {
+            std::list <std::uint32_t> list;
+
+            for ( const listItem& item : listItems )
+            {
+                list.push_back( item.rva );
+            }
+
+            std::uint64_t sum = 0;
+
+            for ( std::uint32_t rva : list )
+            {
+                sum += rva;
+            }
+
+            return sum;
+        });
+    }
+
+    // Appending records to a memory stream, the way directory data is serialized.
+    {
+        static const char recordData[ 20 ] = { 0 };
+
+        RunBench( "stream_append", "eir", numItems, [&]
+        {
+            BasicMemStream::basicMemStreamAllocMan <std::int32_t> streamAllocMan;
+            BasicMemStream::basicMemoryBufferStream <std::int32_t> stream( nullptr, 0, streamAllocMan );
+
+            for ( size_t n = 0; n < numItems; n++ )
+            {
+                stream.Write( recordData, sizeof(recordData) );
+            }
+
+            return (std::uint64_t)stream.Size();
+        });
+        RunBench( "stream_append", "std", numItems, [&]
+        {
+            std::string stream;
+
+            for ( size_t n = 0; n < numItems; n++ )
+            {
+                stream.append( recordData, sizeof(recordData) );
+            }
+
+            return (std::uint64_t)stream.size();
+        });
+    }
+
+    // Reverse index of base relocations, built over one data section full of absolute pointers.
+    {
+        PEFile image;
+
+        RunBench( "reloc_index_build", "eir", numItems, [&]
+        {
+            image = PEFile();
+
+            PEFile::PESection ptrSect;
+            ptrSect.shortName = ".data";
+            ptrSect.stream.Truncate( (std::int32_t)( numItems * sizeof(std::uint32_t) ) );
+            ptrSect.Finalize();
+
+            PEFile::PESection *dataSect = image.AddSection( std::move( ptrSect ) );
+
+            std::uint32_t imageBase = (std::uint32_t)image.GetImageBase();
+
+            for ( size_t n = 0; n < numItems; n++ )
+            {
+                std::uint32_t ptrOff = (std::uint32_t)( n * sizeof(std::uint32_t) );
+
+                dataSect->stream.Seek( ptrOff );
+                dataSect->stream.WriteUInt32( imageBase + rvas[ n ] );
+
+                image.AddRelocation( dataSect->ResolveRVA( ptrOff ), PEFile::PEBaseReloc::eRelocType::HIGHLOW );
+            }
+        },
+        [&]
+        {
+            PEFile::PERelocTargetIndex relocIndex;
+            relocIndex.Build( image );
+
+            const PEFile::PERelocTargetIndex::reference *firstRef;
+
+            return (std::uint64_t)relocIndex.FindReferences( 0, 0xFFFFFFFF, firstRef );
+        });
+    }
+
+    // Layout of the import directory for many descriptors, like the one of a merged executable.
+    // Every tenth function is imported by ordinal. There is no std counterpart.
+    {
+        static const size_t NUM_FUNCS_PER_DESC = 100;
+
+        size_t numDescs = std::max( numItems / NUM_FUNCS_PER_DESC, (size_t)1 );
+
+        PEFile image;
+
+        RunBench( "import_layout", "eir", numDescs * NUM_FUNCS_PER_DESC, [&]
+        {
+            image = PEFile();
+
+            for ( size_t descIdx = 0; descIdx < numDescs; descIdx++ )
+            {
+                PEFile::PEImportDesc impDesc;
+                impDesc.DLLName = ( "module_" + std::to_string( descIdx ) + ".dll" ).c_str();
+
+                for ( size_t funcIdx = 0; funcIdx < NUM_FUNCS_PER_DESC; funcIdx++ )
+                {
+                    PEFile::PEImportDesc::importFunc funcInfo;
+                    funcInfo.isOrdinalImport = ( funcIdx % 10 == 0 );
+                    funcInfo.ordinal_hint = (std::uint16_t)funcIdx;
+
+                    if ( !funcInfo.isOrdinalImport )
+                    {
+                        funcInfo.name = ( "ImportedFunction_" + std::to_string( descIdx ) + "_" + std::to_string( funcIdx ) ).c_str();
+                    }
+
+                    impDesc.funcs.AddToBack( std::move( funcInfo ) );
+                }
+
+                image.imports.AddToBack( std::move( impDesc ) );
+            }
+        },
+        [&]
+        {
+            image.CommitDataDirectories();
+
+            return (std::uint64_t)image.GetSectionCount();
+        });
+    }
+
+    return 0;
+}